@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+#include "physics_engine.h"
+
+/*
+ * Headless benchmark of the physics library. Each scene is built, stepped until it has
+ * settled into the kind of work it is meant to measure, and then timed over a fixed number
+ * of steps. Sleeping is turned off except in the scene that measures a sleeping world.
+ * pyramids4 is the pyramids scene with four substeps in place of the velocity iterations,
+ * and pile-spec the pile with speculative contacts. churn removes and adds bodies every
+ * step and reports whether what the engine holds on to grows. The field scenes are rows of
+ * pyramids of 10k and 50k boxes, only run in the thread scaling.
+ */
+
+struct BenchScene {
+    const char *name;
+    void (*build)(PhysicsEngine *engine, std::vector<Transform> *transforms);
+    bool allow_sleeping;
+    int substeps;
+    bool speculative_contacts;
+};
+
+struct BenchResult {
+    double seconds_per_step;
+    double num_bodies;
+    double num_pairs;
+};
+
+static int add_transform(std::vector<Transform> *transforms) {
+    transforms->push_back(Transform());
+    return transforms->size() - 1;
+}
+
+static ColliderHandle add_box(PhysicsEngine *engine, int transform_id, const vec3 &position,
+        const vec3 &half_lengths, const quat &orientation) {
+    ColliderHandle handle = engine->add_cube_collider(transform_id, half_lengths);
+    Collider *collider = engine->get_collider(handle);
+    collider->body.position() = position;
+    collider->body.orientation() = orientation;
+    collider->body.restitution() = 0.2;
+    collider->body.friction() = 0.3;
+    collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, half_lengths));
+    return handle;
+}
+
+static ColliderHandle add_sphere(PhysicsEngine *engine, int transform_id, const vec3 &position, float radius) {
+    ColliderHandle handle = engine->add_sphere_collider(transform_id, radius);
+    Collider *collider = engine->get_collider(handle);
+    collider->body.position() = position;
+    collider->body.restitution() = 0.2;
+    collider->body.friction() = 0.3;
+    collider->body.set_inertia_tensor(RigidBody::create_sphere_inertia_tensor(1.0, radius));
+    return handle;
+}
+
+static void add_ground(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    Collider *collider = engine->get_collider(engine->add_plane_collider(add_transform(transforms)));
+    collider->body.set_static(true);
+    collider->body.friction() = 0.3;
+}
+
+/*
+ * Ten pyramids of boxes with a base of twelve, resting contacts all the way up.
+ */
+static void build_pyramids(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    add_ground(engine, transforms);
+
+    for (int p = 0; p < 10; p++) {
+        for (int row = 0; row < 12; row++) {
+            for (int i = 0; i < 12 - row; i++) {
+                vec3 position(i * 1.0 + row * 0.5, 0.5 + row * 1.0, p * 3.0);
+                add_box(engine, add_transform(transforms), position, vec3(0.5, 0.5, 0.5), quat(vec3(1.0, 0.0, 0.0), 0.0));
+            }
+        }
+    }
+}
+
+/*
+ * A thousand rotated boxes dropped onto each other, lots of face and edge contacts.
+ */
+static void build_pile(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    add_ground(engine, transforms);
+
+    for (int i = 0; i < 1000; i++) {
+        vec3 position((i % 10) * 1.3, 0.8 + (i / 100) * 1.3, ((i / 10) % 10) * 1.3);
+        quat orientation(vec3(0.3, 1.0, 0.2).normalize(), 0.4 * i);
+        add_box(engine, add_transform(transforms), position, vec3(0.5, 0.4, 0.6), orientation);
+    }
+}
+
+/*
+ * Spheres and boxes mixed, so every narrowphase kernel gets work.
+ */
+static void build_mixed(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    add_ground(engine, transforms);
+
+    for (int i = 0; i < 1000; i++) {
+        vec3 position((i % 10) * 1.1, 0.6 + (i / 100) * 1.1, ((i / 10) % 10) * 1.1);
+
+        if (i % 2 == 0) {
+            add_sphere(engine, add_transform(transforms), position, 0.45);
+        }
+        else {
+            add_box(engine, add_transform(transforms), position, vec3(0.4, 0.4, 0.4), quat(vec3(0.0, 1.0, 0.0), 0.3 * i));
+        }
+    }
+}
+
+/*
+ * Four thousand boxes lying apart on the ground. Once they are asleep a step should cost
+ * next to nothing.
+ */
+static void build_sleeping(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    add_ground(engine, transforms);
+
+    for (int i = 0; i < 4000; i++) {
+        vec3 position((i % 64) * 1.5, 0.5, (i / 64) * 1.5);
+        add_box(engine, add_transform(transforms), position, vec3(0.5, 0.5, 0.5), quat(vec3(1.0, 0.0, 0.0), 0.0));
+    }
+}
+
+#define CHURN_BODIES 2000
+#define CHURN_PER_STEP 10
+
+/*
+ * Drops body i of the churn scene above the ground. Body i takes the place of body
+ * i - CHURN_BODIES, which has long since come to rest at the bottom of the same column.
+ */
+static ColliderHandle add_churn_body(PhysicsEngine *engine, int transform_id, int i) {
+    int column = i % CHURN_BODIES;
+    vec3 position((column % 40) * 1.2, 3.0, (column / 40) * 1.2);
+
+    if (i % 2 == 0) {
+        return add_sphere(engine, transform_id, position, 0.45);
+    }
+
+    return add_box(engine, transform_id, position, vec3(0.4, 0.4, 0.4), quat(vec3(0.0, 1.0, 0.0), 0.3 * i));
+}
+
+/*
+ * Removes the CHURN_PER_STEP oldest bodies and drops as many new ones, reusing their
+ * transforms.
+ */
+static void churn(PhysicsEngine *engine, std::vector<ColliderHandle> *handles, int *next_body) {
+    for (int k = 0; k < CHURN_PER_STEP; k++) {
+        int slot = *next_body % CHURN_BODIES;
+        int transform_id = engine->get_collider((*handles)[slot])->transform_id;
+
+        engine->remove_collider((*handles)[slot]);
+        (*handles)[slot] = add_churn_body(engine, transform_id, *next_body);
+        (*next_body)++;
+    }
+}
+
+static void get_churn_sizes(PhysicsEngine *engine, int sizes[4]) {
+    sizes[0] = engine->stats.num_collider_slots;
+    sizes[1] = engine->stats.num_pooled_colliders;
+    sizes[2] = engine->stats.num_broadphase_nodes;
+    sizes[3] = engine->stats.arena_high_water_mark;
+}
+
+/*
+ * A world whose bodies keep coming and going, like a server's. CHURN_BODIES boxes and
+ * spheres, with the oldest CHURN_PER_STEP removed and replaced before every step, timed
+ * together with the step. Once the collider slots, the pools, the broadphase and the
+ * frame arena have grown to fit they should stay that size, which sizes_before and
+ * sizes_after record at the start and end of the timed steps.
+ */
+static BenchResult run_churn(int num_threads, int warmup_steps, int timed_steps, int sizes_before[4],
+        int sizes_after[4]) {
+    PhysicsEngine engine;
+    std::vector<Transform> transforms;
+    std::vector<ColliderHandle> handles;
+    int next_body = 0;
+
+    add_ground(&engine, &transforms);
+    for (; next_body < CHURN_BODIES; next_body++) {
+        handles.push_back(add_churn_body(&engine, add_transform(&transforms), next_body));
+    }
+
+    engine.transforms = &transforms;
+    engine.set_num_threads(num_threads);
+
+    for (int i = 0; i < warmup_steps; i++) {
+        churn(&engine, &handles, &next_body);
+        engine.update(0.016);
+    }
+
+    get_churn_sizes(&engine, sizes_before);
+
+    BenchResult result;
+    result.num_bodies = 0.0;
+    result.num_pairs = 0.0;
+    double seconds = 0.0;
+
+    for (int i = 0; i < timed_steps; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        churn(&engine, &handles, &next_body);
+        engine.update(0.016);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        seconds += std::chrono::duration<double>(end - start).count();
+        result.num_bodies += engine.stats.num_colliders;
+        result.num_pairs += engine.stats.num_broadphase_pairs;
+    }
+
+    get_churn_sizes(&engine, sizes_after);
+
+    result.seconds_per_step = seconds / timed_steps;
+    result.num_bodies /= timed_steps;
+    result.num_pairs /= timed_steps;
+    return result;
+}
+
+/*
+ * Rows of pyramids alternating between a base of thirty and a base of ten, num_boxes boxes
+ * in all. Each pyramid of thirty is one island with more constraints than split_threshold,
+ * so it is split and solved across the pool, the pyramids of ten are solved one per task.
+ */
+static void build_pyramid_field(PhysicsEngine *engine, std::vector<Transform> *transforms, int num_boxes) {
+    add_ground(engine, transforms);
+
+    int num_added = 0;
+    for (int p = 0; num_added < num_boxes; p++) {
+        int base = p % 2 == 0 ? 30 : 10;
+        float x = (p % 8) * 32.0;
+        float z = (p / 8) * 3.0;
+
+        for (int row = 0; row < base && num_added < num_boxes; row++) {
+            for (int i = 0; i < base - row && num_added < num_boxes; i++) {
+                vec3 position(x + i * 1.0 + row * 0.5, 0.5 + row * 1.0, z);
+                add_box(engine, add_transform(transforms), position, vec3(0.5, 0.5, 0.5), quat(vec3(1.0, 0.0, 0.0), 0.0));
+                num_added++;
+            }
+        }
+    }
+}
+
+static void build_pyramids_10k(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    build_pyramid_field(engine, transforms, 10000);
+}
+
+static void build_pyramids_50k(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    build_pyramid_field(engine, transforms, 50000);
+}
+
+static BenchResult run_scene(BenchScene *scene, int num_threads, int warmup_steps, int timed_steps) {
+    PhysicsEngine engine;
+    std::vector<Transform> transforms;
+
+    scene->build(&engine, &transforms);
+    engine.transforms = &transforms;
+    engine.allow_sleeping = scene->allow_sleeping;
+    engine.substeps = scene->substeps;
+    engine.speculative_contacts = scene->speculative_contacts;
+    engine.set_num_threads(num_threads);
+
+    for (int i = 0; i < warmup_steps; i++) {
+        engine.update(0.016);
+    }
+
+    BenchResult result;
+    result.num_bodies = 0.0;
+    result.num_pairs = 0.0;
+    double seconds = 0.0;
+
+    for (int i = 0; i < timed_steps; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        engine.update(0.016);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        seconds += std::chrono::duration<double>(end - start).count();
+        result.num_bodies += engine.stats.num_colliders;
+        result.num_pairs += engine.stats.num_broadphase_pairs;
+    }
+
+    result.seconds_per_step = seconds / timed_steps;
+    result.num_bodies /= timed_steps;
+    result.num_pairs /= timed_steps;
+    return result;
+}
+
+static void print_result(const char *name, int num_threads, BenchResult result) {
+    double ns_per_step = 1.0e9 * result.seconds_per_step;
+
+    printf("%-10s %7d %12.1f %10.0f %10.0f %10.1f", name, num_threads, 1.0 / result.seconds_per_step,
+            result.num_bodies, result.num_pairs, ns_per_step / MAX(result.num_bodies, 1.0));
+
+    if (result.num_pairs > 0.0) {
+        printf(" %10.1f\n", ns_per_step / result.num_pairs);
+    }
+    else {
+        printf(" %10s\n", "-");
+    }
+}
+
+/*
+ * usage: physics_bench [timed steps] [max threads]
+ */
+int main(int argc, char **argv) {
+    int timed_steps = argc > 1 ? atoi(argv[1]) : 200;
+    int max_threads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    int warmup_steps = 200;
+
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+
+    BenchScene scenes[] = {
+        { "pyramids", build_pyramids, false, 1, false },
+        { "pile", build_pile, false, 1, false },
+        { "mixed", build_mixed, false, 1, false },
+        { "sleeping", build_sleeping, true, 1, false },
+        { "pyramids4", build_pyramids, false, 4, false },
+        { "pile-spec", build_pile, false, 1, true },
+    };
+    int num_scenes = sizeof(scenes) / sizeof(scenes[0]);
+
+    printf("%-10s %7s %12s %10s %10s %10s %10s\n", "scene", "threads", "steps/sec", "bodies", "pairs", "ns/body", "ns/pair");
+
+    for (int i = 0; i < num_scenes; i++) {
+        print_result(scenes[i].name, 1, run_scene(&scenes[i], 1, warmup_steps, timed_steps));
+    }
+
+    int sizes_before[4];
+    int sizes_after[4];
+    print_result("churn", 1, run_churn(1, warmup_steps, timed_steps, sizes_before, sizes_after));
+
+    /*
+     * Thread scaling, on the scenes with enough islands and pairs to spread out, and on
+     * pyramid fields of 10k and 50k boxes from one thread up. Those are big enough for
+     * island splitting to kick in, and slow enough that they get a tenth of the steps.
+     */
+    for (int i = 0; i < 2; i++) {
+        for (int num_threads = 2; num_threads <= max_threads; num_threads *= 2) {
+            print_result(scenes[i].name, num_threads, run_scene(&scenes[i], num_threads, warmup_steps, timed_steps));
+        }
+    }
+
+    BenchScene large_scenes[] = {
+        { "field-10k", build_pyramids_10k, false, 1, false },
+        { "field-50k", build_pyramids_50k, false, 1, false },
+    };
+    int num_large_scenes = sizeof(large_scenes) / sizeof(large_scenes[0]);
+    int large_warmup_steps = warmup_steps / 10;
+    int large_timed_steps = MAX(timed_steps / 10, 1);
+
+    for (int i = 0; i < num_large_scenes; i++) {
+        for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+            print_result(large_scenes[i].name, num_threads,
+                    run_scene(&large_scenes[i], num_threads, large_warmup_steps, large_timed_steps));
+        }
+    }
+
+    /*
+     * Everything the churn scene holds on to, before and after its timed steps.
+     */
+    const char *size_names[] = { "collider slots", "pooled colliders", "broadphase nodes", "arena bytes" };
+    printf("\n%-18s %10s %10s\n", "churn", "before", "after");
+    for (int i = 0; i < 4; i++) {
+        printf("%-18s %10d %10d\n", size_names[i], sizes_before[i], sizes_after[i]);
+    }
+
+    return 0;
+}
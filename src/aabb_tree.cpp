@@ -0,0 +1,490 @@
+#include <algorithm>
+
+#include "aabb_tree.h"
+
+/*
+ * Insertion, removal and balancing follow Box2D's b2DynamicTree.
+ */
+
+AABBTreeNode::AABBTreeNode() {
+    parent = AABB_TREE_NULL_NODE;
+    child1 = AABB_TREE_NULL_NODE;
+    child2 = AABB_TREE_NULL_NODE;
+    height = -1;
+    collider_id = -1;
+}
+
+bool AABBTreeNode::is_leaf() const {
+    return child1 == AABB_TREE_NULL_NODE;
+}
+
+static bool pair_less_than(const BroadphasePair &p1, const BroadphasePair &p2) {
+    if (p1.collider1_id != p2.collider1_id) {
+        return p1.collider1_id < p2.collider1_id;
+    }
+
+    return p1.collider2_id < p2.collider2_id;
+}
+
+DynamicAABBTree::DynamicAABBTree() {
+    root = AABB_TREE_NULL_NODE;
+    free_list = AABB_TREE_NULL_NODE;
+    fat_margin = 0.1;
+    num_reinserted_leaves = 0;
+}
+
+int DynamicAABBTree::allocate_node() {
+    if (free_list == AABB_TREE_NULL_NODE) {
+        nodes.push_back(AABBTreeNode());
+        free_list = nodes.size() - 1;
+    }
+
+    int node_id = free_list;
+    free_list = nodes[node_id].parent;
+    nodes[node_id] = AABBTreeNode();
+    nodes[node_id].height = 0;
+    return node_id;
+}
+
+void DynamicAABBTree::free_node(int node_id) {
+    nodes[node_id].parent = free_list;
+    nodes[node_id].height = -1;
+    free_list = node_id;
+}
+
+void DynamicAABBTree::add_collider(int collider_id) {
+    if (collider_id >= collider_leaves.size()) {
+        collider_leaves.resize(collider_id + 1, AABB_TREE_NULL_NODE);
+        collider_boxes.resize(collider_id + 1);
+    }
+
+    /*
+     * The body has usually not been placed yet, so the leaf is created on the next update.
+     */
+    collider_leaves[collider_id] = AABB_TREE_NULL_NODE;
+}
+
+/*
+ * The collider's slot stays, with no leaf, until a new collider takes over its id.
+ */
+void DynamicAABBTree::remove_collider(int collider_id) {
+    int leaf = collider_leaves[collider_id];
+
+    if (leaf != AABB_TREE_NULL_NODE) {
+        remove_leaf(leaf);
+        free_node(leaf);
+        collider_leaves[collider_id] = AABB_TREE_NULL_NODE;
+    }
+
+    for (int i = 0; i < unbounded_collider_ids.size(); i++) {
+        if (unbounded_collider_ids[i] == collider_id) {
+            unbounded_collider_ids.erase(unbounded_collider_ids.begin() + i);
+            break;
+        }
+    }
+}
+
+void DynamicAABBTree::insert_leaf(int leaf) {
+    if (root == AABB_TREE_NULL_NODE) {
+        root = leaf;
+        nodes[root].parent = AABB_TREE_NULL_NODE;
+        return;
+    }
+
+    /*
+     * Walk down towards the sibling that grows the total surface area the least.
+     */
+    aabb leaf_box = nodes[leaf].box;
+    int index = root;
+    while (!nodes[index].is_leaf()) {
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        float area = nodes[index].box.surface_area();
+        float combined_area = aabb::merge(nodes[index].box, leaf_box).surface_area();
+
+        float cost = 2.0 * combined_area;
+        float inheritance_cost = 2.0 * (combined_area - area);
+
+        float cost1 = aabb::merge(leaf_box, nodes[child1].box).surface_area() + inheritance_cost;
+        if (!nodes[child1].is_leaf()) {
+            cost1 -= nodes[child1].box.surface_area();
+        }
+
+        float cost2 = aabb::merge(leaf_box, nodes[child2].box).surface_area() + inheritance_cost;
+        if (!nodes[child2].is_leaf()) {
+            cost2 -= nodes[child2].box.surface_area();
+        }
+
+        if (cost < cost1 && cost < cost2) {
+            break;
+        }
+
+        index = cost1 < cost2 ? child1 : child2;
+    }
+
+    int sibling = index;
+    int old_parent = nodes[sibling].parent;
+    int new_parent = allocate_node();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].box = aabb::merge(leaf_box, nodes[sibling].box);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].child1 = sibling;
+    nodes[new_parent].child2 = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+
+    if (old_parent == AABB_TREE_NULL_NODE) {
+        root = new_parent;
+    }
+    else if (nodes[old_parent].child1 == sibling) {
+        nodes[old_parent].child1 = new_parent;
+    }
+    else {
+        nodes[old_parent].child2 = new_parent;
+    }
+
+    index = nodes[leaf].parent;
+    while (index != AABB_TREE_NULL_NODE) {
+        index = balance(index);
+
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+        nodes[index].height = 1 + MAX(nodes[child1].height, nodes[child2].height);
+        nodes[index].box = aabb::merge(nodes[child1].box, nodes[child2].box);
+
+        index = nodes[index].parent;
+    }
+}
+
+void DynamicAABBTree::remove_leaf(int leaf) {
+    if (leaf == root) {
+        root = AABB_TREE_NULL_NODE;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grand_parent = nodes[parent].parent;
+    int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grand_parent == AABB_TREE_NULL_NODE) {
+        root = sibling;
+        nodes[sibling].parent = AABB_TREE_NULL_NODE;
+        free_node(parent);
+        return;
+    }
+
+    if (nodes[grand_parent].child1 == parent) {
+        nodes[grand_parent].child1 = sibling;
+    }
+    else {
+        nodes[grand_parent].child2 = sibling;
+    }
+    nodes[sibling].parent = grand_parent;
+    free_node(parent);
+
+    int index = grand_parent;
+    while (index != AABB_TREE_NULL_NODE) {
+        index = balance(index);
+
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+        nodes[index].box = aabb::merge(nodes[child1].box, nodes[child2].box);
+        nodes[index].height = 1 + MAX(nodes[child1].height, nodes[child2].height);
+
+        index = nodes[index].parent;
+    }
+}
+
+/*
+ * If one child of a is more than one level taller than the other, rotate it up to take
+ * a's place. Returns the index of the node now at a's position.
+ *
+ *       a
+ *     /   \
+ *    b     c
+ *   / \   / \
+ *  d   e f   g
+ */
+int DynamicAABBTree::balance(int a) {
+    AABBTreeNode *A = &nodes[a];
+    if (A->is_leaf() || A->height < 2) {
+        return a;
+    }
+
+    int b = A->child1;
+    int c = A->child2;
+    AABBTreeNode *B = &nodes[b];
+    AABBTreeNode *C = &nodes[c];
+
+    int balance = C->height - B->height;
+
+    if (balance > 1) {
+        int f = C->child1;
+        int g = C->child2;
+        AABBTreeNode *F = &nodes[f];
+        AABBTreeNode *G = &nodes[g];
+
+        C->child1 = a;
+        C->parent = A->parent;
+        A->parent = c;
+
+        if (C->parent == AABB_TREE_NULL_NODE) {
+            root = c;
+        }
+        else if (nodes[C->parent].child1 == a) {
+            nodes[C->parent].child1 = c;
+        }
+        else {
+            nodes[C->parent].child2 = c;
+        }
+
+        if (F->height > G->height) {
+            C->child2 = f;
+            A->child2 = g;
+            G->parent = a;
+            A->box = aabb::merge(B->box, G->box);
+            C->box = aabb::merge(A->box, F->box);
+            A->height = 1 + MAX(B->height, G->height);
+            C->height = 1 + MAX(A->height, F->height);
+        }
+        else {
+            C->child2 = g;
+            A->child2 = f;
+            F->parent = a;
+            A->box = aabb::merge(B->box, F->box);
+            C->box = aabb::merge(A->box, G->box);
+            A->height = 1 + MAX(B->height, F->height);
+            C->height = 1 + MAX(A->height, G->height);
+        }
+
+        return c;
+    }
+
+    if (balance < -1) {
+        int d = B->child1;
+        int e = B->child2;
+        AABBTreeNode *D = &nodes[d];
+        AABBTreeNode *E = &nodes[e];
+
+        B->child1 = a;
+        B->parent = A->parent;
+        A->parent = b;
+
+        if (B->parent == AABB_TREE_NULL_NODE) {
+            root = b;
+        }
+        else if (nodes[B->parent].child1 == a) {
+            nodes[B->parent].child1 = b;
+        }
+        else {
+            nodes[B->parent].child2 = b;
+        }
+
+        if (D->height > E->height) {
+            B->child2 = d;
+            A->child1 = e;
+            E->parent = a;
+            A->box = aabb::merge(C->box, E->box);
+            B->box = aabb::merge(A->box, D->box);
+            A->height = 1 + MAX(C->height, E->height);
+            B->height = 1 + MAX(A->height, D->height);
+        }
+        else {
+            B->child2 = e;
+            A->child1 = d;
+            D->parent = a;
+            A->box = aabb::merge(C->box, D->box);
+            B->box = aabb::merge(A->box, E->box);
+            A->height = 1 + MAX(C->height, D->height);
+            B->height = 1 + MAX(A->height, E->height);
+        }
+
+        return b;
+    }
+
+    return a;
+}
+
+/*
+ * Refit the tree to the colliders' current boxes. Leaves whose collider is still inside
+ * its fat box are left alone.
+ */
+void DynamicAABBTree::refit(const std::vector<Collider*> &colliders) {
+    num_reinserted_leaves = 0;
+
+    for (int i = 0; i < collider_leaves.size(); i++) {
+        if (colliders[i] == NULL) {
+            continue;
+        }
+
+        if (colliders[i]->body.is_sleeping() && collider_leaves[i] != AABB_TREE_NULL_NODE) {
+            continue;
+        }
+
+        aabb box = get_collider_box(colliders[i]);
+        collider_boxes[i] = box;
+
+        if (box.is_unbounded()) {
+            if (std::find(unbounded_collider_ids.begin(), unbounded_collider_ids.end(), i) == unbounded_collider_ids.end()) {
+                unbounded_collider_ids.push_back(i);
+            }
+            continue;
+        }
+
+        int leaf = collider_leaves[i];
+
+        if (leaf != AABB_TREE_NULL_NODE) {
+            if (nodes[leaf].box.contains(box)) {
+                continue;
+            }
+
+            remove_leaf(leaf);
+        }
+        else {
+            leaf = allocate_node();
+            nodes[leaf].collider_id = i;
+            collider_leaves[i] = leaf;
+        }
+
+        nodes[leaf].box = box.expand(fat_margin);
+        insert_leaf(leaf);
+        num_reinserted_leaves++;
+    }
+}
+
+void DynamicAABBTree::find_pairs(const std::vector<Collider*> &colliders, std::vector<BroadphasePair> *pairs) {
+    pairs->clear();
+    refit(colliders);
+
+    for (int i = 0; i < collider_leaves.size(); i++) {
+        Collider *collider1 = colliders[i];
+        if (collider1 == NULL || !collider1->body.is_awake()) {
+            continue;
+        }
+
+        pair_candidates.clear();
+        query(collider_boxes[i], &pair_candidates);
+        for (int j = 0; j < unbounded_collider_ids.size(); j++) {
+            pair_candidates.push_back(unbounded_collider_ids[j]);
+        }
+
+        for (int j = 0; j < pair_candidates.size(); j++) {
+            int other_id = pair_candidates[j];
+            Collider *collider2 = colliders[other_id];
+
+            /*
+             * Pairs of two awake colliders are found from both ends, keep only one.
+             */
+            if (other_id == i || (collider2->body.is_awake() && other_id < i)) {
+                continue;
+            }
+
+            if (!collider_boxes[i].overlaps(collider_boxes[other_id])) {
+                continue;
+            }
+
+            BroadphasePair pair;
+            pair.collider1_id = MIN(i, other_id);
+            pair.collider2_id = MAX(i, other_id);
+            pairs->push_back(pair);
+        }
+    }
+
+    std::sort(pairs->begin(), pairs->end(), pair_less_than);
+}
+
+void DynamicAABBTree::query(const aabb &box, std::vector<int> *collider_ids) {
+    if (root == AABB_TREE_NULL_NODE) {
+        return;
+    }
+
+    int stack[AABB_TREE_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while (stack_size > 0) {
+        AABBTreeNode *node = &nodes[stack[--stack_size]];
+
+        if (!node->box.overlaps(box)) {
+            continue;
+        }
+
+        if (node->is_leaf()) {
+            collider_ids->push_back(node->collider_id);
+        }
+        else {
+            stack[stack_size++] = node->child1;
+            stack[stack_size++] = node->child2;
+        }
+    }
+}
+
+/*
+ * Tests against the fat boxes from the last refit, the leaves are not refit first.
+ * Unbounded colliders always count as overlapping.
+ */
+void DynamicAABBTree::query_box(const aabb &box, std::vector<int> *collider_ids) {
+    for (int i = 0; i < unbounded_collider_ids.size(); i++) {
+        collider_ids->push_back(unbounded_collider_ids[i]);
+    }
+
+    query(box, collider_ids);
+}
+
+/*
+ * Walks the tree once per packet of rays, descending into a node while any ray of the
+ * packet still reaches its box. Hits lower the rays' max_t as the walk goes, so boxes
+ * behind a hit are skipped. Like query_box it works off the tree as last refit.
+ */
+void DynamicAABBTree::query_rays(const ray *rays, int num_rays, float max_t, RayHitCallback callback, void *data) {
+    for (int first_ray = 0; first_ray < num_rays; first_ray += RAY_PACKET_SIZE) {
+        ray_packet packet(rays + first_ray, MIN(num_rays - first_ray, RAY_PACKET_SIZE), max_t);
+
+        for (int i = 0; i < unbounded_collider_ids.size(); i++) {
+            int collider_id = unbounded_collider_ids[i];
+            int lanes = packet.intersect_aabb(collider_boxes[collider_id]);
+            report_ray_hits(&packet, first_ray, lanes, collider_id, callback, data);
+        }
+
+        if (root == AABB_TREE_NULL_NODE) {
+            continue;
+        }
+
+        int stack[AABB_TREE_STACK_SIZE];
+        int stack_size = 0;
+        stack[stack_size++] = root;
+
+        while (stack_size > 0) {
+            AABBTreeNode *node = &nodes[stack[--stack_size]];
+
+            int lanes = packet.intersect_aabb(node->box);
+            if (lanes == 0) {
+                continue;
+            }
+
+            if (node->is_leaf()) {
+                report_ray_hits(&packet, first_ray, lanes, node->collider_id, callback, data);
+            }
+            else {
+                stack[stack_size++] = node->child1;
+                stack[stack_size++] = node->child2;
+            }
+        }
+    }
+}
+
+/*
+ * Counts the free nodes kept for reuse as well as those in the tree.
+ */
+int DynamicAABBTree::get_num_nodes() {
+    return nodes.size();
+}
+
+int DynamicAABBTree::get_height() {
+    if (root == AABB_TREE_NULL_NODE) {
+        return 0;
+    }
+
+    return nodes[root].height;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "broadphase.h"
+
+#define AABB_TREE_NULL_NODE -1
+#define AABB_TREE_STACK_SIZE 256
+
+struct AABBTreeNode {
+    aabb box;
+    int parent;
+    int child1, child2;
+    int height;
+    int collider_id;
+
+    AABBTreeNode();
+    bool is_leaf() const;
+};
+
+/*
+ * Dynamic bounding volume tree over fattened collider boxes. A leaf is only moved when the
+ * collider's box leaves its fat box, and the tree is kept balanced with rotations as
+ * leaves are inserted and removed. Unbounded colliders like the ground plane are kept out
+ * of the tree and paired with everything.
+ */
+class DynamicAABBTree : public Broadphase {
+    private:
+        std::vector<AABBTreeNode> nodes;
+        int root;
+        int free_list;
+
+        std::vector<int> collider_leaves;
+        std::vector<aabb> collider_boxes;
+        std::vector<int> unbounded_collider_ids;
+        std::vector<int> pair_candidates;
+
+        int allocate_node();
+        void free_node(int node_id);
+        void insert_leaf(int leaf);
+        void remove_leaf(int leaf);
+        int balance(int node_id);
+
+    public:
+        float fat_margin;
+        int num_reinserted_leaves;
+
+        DynamicAABBTree();
+        virtual void add_collider(int collider_id);
+        virtual void remove_collider(int collider_id);
+        virtual void refit(const std::vector<Collider*> &colliders);
+        virtual void find_pairs(const std::vector<Collider*> &colliders, std::vector<BroadphasePair> *pairs);
+        virtual void query_rays(const ray *rays, int num_rays, float max_t, RayHitCallback callback, void *data);
+        virtual void query_box(const aabb &box, std::vector<int> *collider_ids);
+        virtual int get_num_nodes();
+
+        void query(const aabb &box, std::vector<int> *collider_ids);
+        int get_height();
+};
@@ -0,0 +1,212 @@
+#include <algorithm>
+
+#include "broadphase.h"
+
+static bool pair_less_than(const BroadphasePair &p1, const BroadphasePair &p2) {
+    if (p1.collider1_id != p2.collider1_id) {
+        return p1.collider1_id < p2.collider1_id;
+    }
+
+    return p1.collider2_id < p2.collider2_id;
+}
+
+struct ProxyMinLessThan {
+    int axis;
+
+    bool operator()(const SweepAndPruneProxy &p1, const SweepAndPruneProxy &p2) const {
+        return p1.box.min[axis] < p2.box.min[axis];
+    }
+};
+
+Broadphase::Broadphase() {
+    speculative_time = 0.0;
+}
+
+Broadphase::~Broadphase() {
+}
+
+void Broadphase::report_ray_hits(ray_packet *packet, int first_ray, int lanes, int collider_id,
+        RayHitCallback callback, void *data) {
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+        if (lanes & (1 << lane)) {
+            callback(data, first_ray + lane, collider_id, &packet->max_t[lane]);
+        }
+    }
+}
+
+aabb Broadphase::get_collider_box(Collider *collider) {
+    aabb box = collider->get_aabb();
+
+    if (speculative_time <= 0.0 || box.is_unbounded()) {
+        return box;
+    }
+
+    vec3 displacement = speculative_time * collider->body.velocity();
+    return aabb::merge(box, aabb(box.min + displacement, box.max + displacement));
+}
+
+SweepAndPrune::SweepAndPrune() {
+    axis = 0;
+}
+
+void SweepAndPrune::add_collider(int collider_id) {
+    SweepAndPruneProxy proxy;
+    proxy.collider_id = collider_id;
+    proxies.push_back(proxy);
+}
+
+/*
+ * Erasing keeps the other proxies in their sorted order.
+ */
+void SweepAndPrune::remove_collider(int collider_id) {
+    for (int i = 0; i < proxies.size(); i++) {
+        if (proxies[i].collider_id == collider_id) {
+            proxies.erase(proxies.begin() + i);
+            return;
+        }
+    }
+}
+
+/*
+ * Sweep along the axis with the largest spread of box centers. Unbounded boxes like the
+ * ground plane are left out since they overlap everything on every axis anyway.
+ */
+void SweepAndPrune::choose_axis() {
+    vec3 sum, sum_squared;
+    int count = 0;
+
+    for (int i = 0; i < proxies.size(); i++) {
+        aabb box = proxies[i].box;
+
+        if (box.is_unbounded()) {
+            continue;
+        }
+
+        vec3 center = 0.5 * (box.min + box.max);
+        sum = sum + center;
+        sum_squared = sum_squared + vec3(center.x * center.x, center.y * center.y, center.z * center.z);
+        count++;
+    }
+
+    if (count < 2) {
+        return;
+    }
+
+    vec3 mean = (1.0 / count) * sum;
+    vec3 variance = (1.0 / count) * sum_squared - vec3(mean.x * mean.x, mean.y * mean.y, mean.z * mean.z);
+
+    int new_axis = 0;
+    if (variance.y > variance[new_axis]) {
+        new_axis = 1;
+    }
+    if (variance.z > variance[new_axis]) {
+        new_axis = 2;
+    }
+
+    axis = new_axis;
+}
+
+/*
+ * Insertion sort on the min endpoint. Bodies move little from one step to the next, so
+ * this is close to linear in the number of proxies.
+ */
+void SweepAndPrune::sort_proxies() {
+    for (int i = 1; i < proxies.size(); i++) {
+        SweepAndPruneProxy proxy = proxies[i];
+        float key = proxy.box.min[axis];
+
+        int j = i - 1;
+        while (j >= 0 && proxies[j].box.min[axis] > key) {
+            proxies[j + 1] = proxies[j];
+            j--;
+        }
+        proxies[j + 1] = proxy;
+    }
+}
+
+void SweepAndPrune::refit(const std::vector<Collider*> &colliders) {
+    for (int i = 0; i < proxies.size(); i++) {
+        proxies[i].box = get_collider_box(colliders[proxies[i].collider_id]);
+    }
+}
+
+void SweepAndPrune::find_pairs(const std::vector<Collider*> &colliders, std::vector<BroadphasePair> *pairs) {
+    pairs->clear();
+    refit(colliders);
+
+    int old_axis = axis;
+    choose_axis();
+
+    if (axis == old_axis) {
+        sort_proxies();
+    }
+    else {
+        ProxyMinLessThan less_than;
+        less_than.axis = axis;
+        std::sort(proxies.begin(), proxies.end(), less_than);
+    }
+
+    for (int i = 0; i < proxies.size(); i++) {
+        SweepAndPruneProxy *proxy1 = &proxies[i];
+        Collider *collider1 = colliders[proxy1->collider_id];
+
+        for (int j = i + 1; j < proxies.size(); j++) {
+            SweepAndPruneProxy *proxy2 = &proxies[j];
+
+            if (proxy2->box.min[axis] > proxy1->box.max[axis]) {
+                break;
+            }
+
+            Collider *collider2 = colliders[proxy2->collider_id];
+            if (!collider1->body.is_awake() && !collider2->body.is_awake()) {
+                continue;
+            }
+
+            if (!proxy1->box.overlaps(proxy2->box)) {
+                continue;
+            }
+
+            BroadphasePair pair;
+            pair.collider1_id = MIN(proxy1->collider_id, proxy2->collider_id);
+            pair.collider2_id = MAX(proxy1->collider_id, proxy2->collider_id);
+            pairs->push_back(pair);
+        }
+    }
+
+    /*
+     * Hand the pairs to the narrowphase in the same order the brute force loop did, so the
+     * solver sees the contacts in a stable order no matter how the proxies were sorted.
+     */
+    std::sort(pairs->begin(), pairs->end(), pair_less_than);
+}
+
+/*
+ * The sorted list gives no help for rays, so every proxy box from the last refit is slab
+ * tested against each packet of rays.
+ */
+void SweepAndPrune::query_rays(const ray *rays, int num_rays, float max_t, RayHitCallback callback, void *data) {
+    for (int first_ray = 0; first_ray < num_rays; first_ray += RAY_PACKET_SIZE) {
+        ray_packet packet(rays + first_ray, MIN(num_rays - first_ray, RAY_PACKET_SIZE), max_t);
+
+        for (int i = 0; i < proxies.size(); i++) {
+            int collider_id = proxies[i].collider_id;
+            int lanes = packet.intersect_aabb(proxies[i].box);
+            report_ray_hits(&packet, first_ray, lanes, collider_id, callback, data);
+        }
+    }
+}
+
+/*
+ * Tests against the boxes from the last refit.
+ */
+void SweepAndPrune::query_box(const aabb &box, std::vector<int> *collider_ids) {
+    for (int i = 0; i < proxies.size(); i++) {
+        if (proxies[i].box.overlaps(box)) {
+            collider_ids->push_back(proxies[i].collider_id);
+        }
+    }
+}
+
+int SweepAndPrune::get_num_nodes() {
+    return proxies.size();
+}
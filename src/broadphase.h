@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "collide_fine.h"
+
+struct BroadphasePair {
+    int collider1_id;
+    int collider2_id;
+};
+
+/*
+ * Called by query_rays for a ray and each collider whose box the ray enters within *max_t.
+ * The callback can lower *max_t so the query stops looking past a hit, or set it below zero
+ * so the query stops looking for that ray altogether.
+ */
+typedef void (*RayHitCallback)(void *data, int ray_id, int collider_id, float *max_t);
+
+/*
+ * refit brings the boxes up to date with the colliders, find_pairs does so itself. The
+ * queries see the colliders where the last refit left them and only read the broadphase,
+ * so several threads can query at once. With speculative_time above zero the boxes are
+ * stretched along the colliders' velocities to cover where they can get to in that time,
+ * so pairs that may touch before the next step are found too.
+ */
+class Broadphase {
+    protected:
+        aabb get_collider_box(Collider *collider);
+        void report_ray_hits(ray_packet *packet, int first_ray, int lanes, int collider_id,
+                RayHitCallback callback, void *data);
+
+    public:
+        float speculative_time;
+
+        Broadphase();
+        virtual ~Broadphase();
+        virtual void add_collider(int collider_id) = 0;
+        virtual void remove_collider(int collider_id) = 0;
+        virtual void refit(const std::vector<Collider*> &colliders) = 0;
+        virtual void find_pairs(const std::vector<Collider*> &colliders, std::vector<BroadphasePair> *pairs) = 0;
+        virtual void query_rays(const ray *rays, int num_rays, float max_t, RayHitCallback callback, void *data) = 0;
+        virtual void query_box(const aabb &box, std::vector<int> *collider_ids) = 0;
+        virtual int get_num_nodes() = 0;
+};
+
+struct SweepAndPruneProxy {
+    int collider_id;
+    aabb box;
+};
+
+/*
+ * Sort and sweep over world space AABBs. The proxies stay sorted between calls, so each
+ * update is an insertion sort over an almost sorted list.
+ */
+class SweepAndPrune : public Broadphase {
+    private:
+        std::vector<SweepAndPruneProxy> proxies;
+        int axis;
+
+        void choose_axis();
+        void sort_proxies();
+
+    public:
+        SweepAndPrune();
+        virtual void add_collider(int collider_id);
+        virtual void remove_collider(int collider_id);
+        virtual void refit(const std::vector<Collider*> &colliders);
+        virtual void find_pairs(const std::vector<Collider*> &colliders, std::vector<BroadphasePair> *pairs);
+        virtual void query_rays(const ray *rays, int num_rays, float max_t, RayHitCallback callback, void *data);
+        virtual void query_box(const aabb &box, std::vector<int> *collider_ids);
+        virtual int get_num_nodes();
+};
@@ -1,131 +1,244 @@
 #include "collide_fine.h"
-#include "renderer.h"
 
-void BoxCollider::update_transform(Transform *transform) {
-    transform->scale = 2.0 * half_lengths;
-    transform->translation = body.position;
-    transform->orientation = body.orientation;
+PairCache::PairCache() {
+    axis = -1;
 }
 
-ContactManifold BoxCollider::collide(Collider *collider) {
-    return collider->collide_with(this);
+Contact::Contact() {
+    penetration = 0.0;
+    is_resting_contact = false;
+    feature_id = -1;
+    normal_impulse = 0.0;
 }
 
-bool BoxCollider::contains_point(const vec3 &point) {
-    mat4 transformation = body.orientation.get_matrix().inverse();
-    vec3 box_point = transformation * (point - body.position);
-    vec3 new_half_lengths = half_lengths + vec3(0.01, 0.01, 0.01);
-
-    if (box_point.x < -new_half_lengths.x || box_point.x > new_half_lengths.x) {
-        return false;
-    }
+ContactManifold::ContactManifold() {
+    collider1 = NULL;
+    collider2 = NULL;
+    num_contacts = 0;
+}
 
-    if (box_point.y < -new_half_lengths.y || box_point.y > new_half_lengths.y) {
-        return false;
+/*
+ * Contacts past MAX_MANIFOLD_CONTACTS are dropped, colliders that can find more reduce
+ * them with reduce_contacts first.
+ */
+void ContactManifold::add_contact(const Contact &contact) {
+    if (num_contacts < MAX_MANIFOLD_CONTACTS) {
+        contacts[num_contacts++] = contact;
     }
+}
 
-    if (box_point.z < -new_half_lengths.z || box_point.z > new_half_lengths.z) {
-        return false;
-    }
+/*
+ * Writes the body's current pose into transform.
+ */
+void Collider::update_transform(Transform *transform) {
+    set_transform(transform, body.position(), body.orientation());
+}
 
-    return true;
+BoxCollider::BoxCollider() {
+    shape = SHAPE_BOX;
+}
 
-    vec3 axes[3];
-    axes[0] = vec3(transformation.m[0], transformation.m[4], transformation.m[8]).normalize();
-    axes[1] = vec3(transformation.m[1], transformation.m[5], transformation.m[9]).normalize();
-    axes[2] = vec3(transformation.m[2], transformation.m[6], transformation.m[10]).normalize();
+void BoxCollider::set_transform(Transform *transform, const vec3 &position, const quat &orientation) {
+    transform->scale = 2.0 * half_lengths;
+    transform->translation = position;
+    transform->orientation = orientation;
+}
 
-    float axes_0_dist = vec3::dot(point - body.position, axes[0]);
-    if (axes_0_dist < -half_lengths.x || axes_0_dist > half_lengths.x) {
-        return false;
+/*
+ * The corners of the face whose outward normal is closest to direction, in order around
+ * the face. Returns the face as axis * 2, plus 1 for the face on the negative side.
+ */
+int BoxCollider::get_face(const vec3 &direction, vec3 *vertices) {
+    mat3 rotation = body.orientation().get_rotation();
+    vec3 local_direction = rotation.transpose_multiply(direction);
+
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (ABS(local_direction[i]) > ABS(local_direction[axis])) {
+            axis = i;
+        }
     }
 
-    float axes_1_dist = vec3::dot(point - body.position, axes[1]);
-    if (axes_1_dist < -half_lengths.y || axes_1_dist > half_lengths.y) {
-        return false;
-    }
+    float sign = local_direction[axis] > 0.0 ? 1.0 : -1.0;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
 
-    float axes_2_dist = vec3::dot(point - body.position, axes[2]);
-    if (axes_2_dist < -half_lengths.z || axes_2_dist > half_lengths.z) {
-        return false;
+    float corner_signs[4][2] = { {1.0, 1.0}, {-1.0, 1.0}, {-1.0, -1.0}, {1.0, -1.0} };
+
+    for (int i = 0; i < 4; i++) {
+        vec3 corner;
+        corner[axis] = sign * half_lengths[axis];
+        corner[u] = corner_signs[i][0] * half_lengths[u];
+        corner[v] = corner_signs[i][1] * half_lengths[v];
+        vertices[i] = rotation * corner + body.position();
     }
 
-    return true;
+    return 2 * axis + (sign < 0.0 ? 1 : 0);
 }
 
-void BoxCollider::get_points(vec3 *points) {
-    mat4 transformation = body.orientation.get_matrix();
-    vec3 position = body.position;
+/*
+ * The edge parallel to the given box axis that lies furthest along direction.
+ */
+line_segment BoxCollider::get_support_edge(int axis, const vec3 &direction) {
+    mat3 rotation = body.orientation().get_rotation();
+    vec3 center = body.position();
+
+    for (int i = 0; i < 3; i++) {
+        if (i == axis) {
+            continue;
+        }
+
+        vec3 column = rotation.column(i);
+        float sign = vec3::dot(column, direction) > 0.0 ? 1.0 : -1.0;
+        center = center + (sign * half_lengths[i]) * column;
+    }
 
-    points[0] = transformation * vec3(half_lengths.x, half_lengths.y, half_lengths.z) + position;
-    points[1] = transformation * vec3(half_lengths.x, half_lengths.y, -half_lengths.z) + position;
-    points[2] = transformation * vec3(half_lengths.x, -half_lengths.y, half_lengths.z) + position;
-    points[3] = transformation * vec3(half_lengths.x, -half_lengths.y, -half_lengths.z) + position;
-    points[4] = transformation * vec3(-half_lengths.x, half_lengths.y, half_lengths.z) + position;
-    points[5] = transformation * vec3(-half_lengths.x, half_lengths.y, -half_lengths.z) + position;
-    points[6] = transformation * vec3(-half_lengths.x, -half_lengths.y, half_lengths.z) + position;
-    points[7] = transformation * vec3(-half_lengths.x, -half_lengths.y, -half_lengths.z) + position;
+    vec3 extent = half_lengths[axis] * rotation.column(axis);
+    return line_segment(center - extent, center + extent);
 }
 
-void BoxCollider::get_edges(line_segment *edges) {
-    static int edge_indices[12][2] = {
-        {0, 1}, {0, 2}, {1, 3}, {2, 3},
-        {4, 5}, {4, 6}, {5, 7}, {6, 7},
-        {0, 4}, {1, 5}, {2, 6}, {3, 7},
-    };
+/*
+ * One Sutherland-Hodgman pass, keeps the part of the polygon with dot(n, p) <= offset.
+ */
+static int clip_polygon(const vec3 *in, int num_in, const vec3 &n, float offset, vec3 *out) {
+    int num_out = 0;
 
-    vec3 points[8];
-    get_points(points);
+    for (int i = 0; i < num_in; i++) {
+        vec3 a = in[i];
+        vec3 b = in[(i + 1) % num_in];
+        float da = vec3::dot(n, a) - offset;
+        float db = vec3::dot(n, b) - offset;
+
+        if (da <= 0.0) {
+            out[num_out++] = a;
+        }
 
-    for (int i = 0; i < 12; i++) {
-        edges[i] = line_segment(points[edge_indices[i][0]], points[edge_indices[i][1]]);
+        if ((da <= 0.0) != (db <= 0.0)) {
+            out[num_out++] = a + (da / (da - db)) * (b - a);
+        }
     }
+
+    return num_out;
 }
 
-void BoxCollider::get_planes(plane *planes) {
-    mat4 transformation = body.orientation.get_matrix();    
+/*
+ * Closest points between segments p1-q1 and p2-q2, from Ericson's Real-Time Collision
+ * Detection 5.1.9.
+ */
+static void closest_points_on_segments(const line_segment &s1, const line_segment &s2, vec3 *c1, vec3 *c2) {
+    vec3 d1 = s1.p1 - s1.p0;
+    vec3 d2 = s2.p1 - s2.p0;
+    vec3 r = s1.p0 - s2.p0;
+
+    float a = vec3::dot(d1, d1);
+    float e = vec3::dot(d2, d2);
+    float f = vec3::dot(d2, r);
+    float c = vec3::dot(d1, r);
+    float b = vec3::dot(d1, d2);
+    float denominator = a * e - b * b;
+
+    float s = 0.0;
+    if (denominator > 0.0) {
+        s = MAX(0.0, MIN(1.0, (b * f - c * e) / denominator));
+    }
 
-    vec3 axes[3];
-    axes[0] = vec3(transformation.m[0], transformation.m[4], transformation.m[8]).normalize();
-    axes[1] = vec3(transformation.m[1], transformation.m[5], transformation.m[9]).normalize();
-    axes[2] = vec3(transformation.m[2], transformation.m[6], transformation.m[10]).normalize();
+    float t = (b * s + f) / e;
 
-    planes[0] = plane(body.position + half_lengths.x * axes[0], axes[0]);
-    planes[1] = plane(body.position - half_lengths.x * axes[0], -1.0 * axes[0]);
-    planes[2] = plane(body.position + half_lengths.y * axes[1], axes[1]);
-    planes[3] = plane(body.position - half_lengths.y * axes[1], -1.0 * axes[1]);
-    planes[4] = plane(body.position + half_lengths.z * axes[2], axes[2]);
-    planes[5] = plane(body.position - half_lengths.z * axes[2], -1.0 * axes[2]);
+    if (t < 0.0) {
+        t = 0.0;
+        s = MAX(0.0, MIN(1.0, -c / a));
+    }
+    else if (t > 1.0) {
+        t = 1.0;
+        s = MAX(0.0, MIN(1.0, (b - c) / a));
+    }
+
+    *c1 = s1.p0 + s * d1;
+    *c2 = s2.p0 + t * d2;
 }
 
-void BoxCollider::clip_edges(line_segment *edges, std::vector<vec3> *contact_points) {
-    plane planes[6];
-    get_planes(planes);
+/*
+ * Keeps at most four of the contacts, the deepest one, the one furthest from it, and the
+ * two that span the largest area with those on either side. Returns how many are kept.
+ */
+static int reduce_contacts(Contact *contacts, int num_contacts, const vec3 &normal) {
+    if (num_contacts <= 4) {
+        return num_contacts;
+    }
 
-    for (int i = 0; i < 6; i++) {
-        plane p = planes[i];
+    int i0 = 0;
+    for (int i = 1; i < num_contacts; i++) {
+        if (contacts[i].penetration > contacts[i0].penetration) {
+            i0 = i;
+        }
+    }
 
-        for (int j = 0; j < 12; j++) {
-            line_segment e = edges[j];
-            vec3 intersection;
+    int i1 = -1;
+    float max_distance = -1.0;
+    for (int i = 0; i < num_contacts; i++) {
+        float distance = (contacts[i].position - contacts[i0].position).length_squared();
+        if (i != i0 && distance > max_distance) {
+            max_distance = distance;
+            i1 = i;
+        }
+    }
 
-            if (e.intersect_plane(p, &intersection)) {
-                if (contains_point(intersection)) {
-                    contact_points->push_back(intersection);
-                }
-            }
+    vec3 p0 = contacts[i0].position;
+    vec3 edge = contacts[i1].position - p0;
+
+    int i2 = -1;
+    int i3 = -1;
+    float max_area = 0.0;
+    float min_area = 0.0;
+    for (int i = 0; i < num_contacts; i++) {
+        if (i == i0 || i == i1) {
+            continue;
+        }
+
+        float area = vec3::dot(vec3::cross(edge, contacts[i].position - p0), normal);
+        if (area > max_area) {
+            max_area = area;
+            i2 = i;
+        }
+        if (area < min_area) {
+            min_area = area;
+            i3 = i;
         }
     }
+
+    Contact kept[4];
+    int num_kept = 0;
+    kept[num_kept++] = contacts[i0];
+    kept[num_kept++] = contacts[i1];
+    if (i2 != -1) {
+        kept[num_kept++] = contacts[i2];
+    }
+    if (i3 != -1) {
+        kept[num_kept++] = contacts[i3];
+    }
+
+    for (int i = 0; i < num_kept; i++) {
+        contacts[i] = kept[i];
+    }
+
+    return num_kept;
 }
 
-ContactManifold BoxCollider::collide_with(SphereCollider *collider) {
-    ContactManifold manifold;
-    manifold.collider1 = collider;
-    manifold.collider2 = this;
+void BoxCollider::collide_with(SphereCollider *collider, float margin, PairCache *cache, ContactManifold *manifold) {
+    manifold->collider1 = collider;
+    manifold->collider2 = this;
 
-    mat4 transformation = body.orientation.get_matrix();
+    rigid_transform transformation = body.get_transform();
 
-    vec3 closest_pt_on_box = transformation.inverse() * (collider->body.position - body.position);
+    vec3 center = transformation.inverse_transform_point(collider->body.position());
+
+    /* decided in box space, the trip back to world space leaves dist tiny rather than zero */
+    if (ABS(center.x) <= half_lengths.x && ABS(center.y) <= half_lengths.y && ABS(center.z) <= half_lengths.z) {
+        collide_with_inside_sphere(collider, center, transformation, manifold);
+        return;
+    }
+
+    vec3 closest_pt_on_box = center;
 
     if (closest_pt_on_box.x > half_lengths.x) closest_pt_on_box.x = half_lengths.x;
     if (closest_pt_on_box.x < -half_lengths.x) closest_pt_on_box.x = -half_lengths.x;
@@ -136,150 +249,257 @@ ContactManifold BoxCollider::collide_with(SphereCollider *collider) {
     if (closest_pt_on_box.z > half_lengths.z) closest_pt_on_box.z = half_lengths.z;
     if (closest_pt_on_box.z < -half_lengths.z) closest_pt_on_box.z = -half_lengths.z;
 
-    closest_pt_on_box = (transformation * closest_pt_on_box) + body.position;
+    closest_pt_on_box = transformation.transform_point(closest_pt_on_box);
 
-    float dist = (closest_pt_on_box - collider->body.position).length_squared();
+    float dist = (closest_pt_on_box - collider->body.position()).length_squared();
 
-    if (dist > collider->radius * collider->radius) {
-        return manifold;
+    float reach = collider->radius + margin;
+    if (dist > reach * reach) {
+        return;
     }
 
-    vec3 normal = (closest_pt_on_box - collider->body.position).normalize();
-    vec3 closest_pt_on_sphere = collider->body.position + collider->radius * normal; 
+    vec3 normal = (closest_pt_on_box - collider->body.position()).normalize();
+    vec3 closest_pt_on_sphere = collider->body.position() + collider->radius * normal; 
 
     Contact contact;
     contact.normal = normal;
     contact.position = 0.5 * (closest_pt_on_sphere + closest_pt_on_box);
     contact.penetration = (closest_pt_on_box - closest_pt_on_sphere).length();
-    manifold.contacts.push_back(contact);
-
-    return manifold;
+    if (dist > collider->radius * collider->radius) {
+        contact.penetration = -contact.penetration;
+    }
+    contact.feature_id = 0;
+    manifold->add_contact(contact);
 }
 
-ContactManifold BoxCollider::collide_with(BoxCollider *collider) {
-    ContactManifold manifold;
-    manifold.collider1 = collider;
-    manifold.collider2 = this;
+/*
+ * The sphere's center is inside the box, or on its surface, so there is no direction from
+ * the center to the closest point. The sphere is pushed out through the nearest face
+ * instead, as deep as its radius plus the center's distance to that face.
+ */
+void BoxCollider::collide_with_inside_sphere(SphereCollider *collider, const vec3 &center,
+        const rigid_transform &transformation, ContactManifold *manifold) {
+    int face_axis = 0;
+    float max_gap = -FLT_MAX;
+
+    for (int i = 0; i < 3; i++) {
+        float gap = ABS(center[i]) - half_lengths[i];
+
+        if (gap > max_gap) {
+            face_axis = i;
+            max_gap = gap;
+        }
+    }
 
-    RigidBody body1 = this->body;
-    RigidBody body2 = collider->body;
+    vec3 axis = transformation.rotation.column(face_axis);
+    vec3 normal = center[face_axis] > 0.0 ? -1.0 * axis : axis;
 
-    mat4 transformation1 = body1.orientation.get_matrix();
-    mat4 transformation2 = body2.orientation.get_matrix();
+    vec3 closest_pt_on_box = center;
+    closest_pt_on_box[face_axis] = center[face_axis] > 0.0 ? half_lengths[face_axis] : -half_lengths[face_axis];
+    closest_pt_on_box = transformation.transform_point(closest_pt_on_box);
+    vec3 closest_pt_on_sphere = collider->body.position() + collider->radius * normal;
 
-    vec3 axes[15];
+    Contact contact;
+    contact.normal = normal;
+    contact.position = 0.5 * (closest_pt_on_sphere + closest_pt_on_box);
+    contact.penetration = collider->radius - max_gap;
+    contact.feature_id = 0;
+    manifold->add_contact(contact);
+}
 
-    axes[0] = vec3(transformation1.m[0], transformation1.m[4], transformation1.m[8]).normalize();
-    axes[1] = vec3(transformation1.m[1], transformation1.m[5], transformation1.m[9]).normalize();
-    axes[2] = vec3(transformation1.m[2], transformation1.m[6], transformation1.m[10]).normalize();
+/*
+ * Half the length of the box's projection onto axis.
+ */
+static float get_projected_radius(const vec3 &axis, const vec3 *box_axes, const vec3 &half_lengths) {
+    return half_lengths.x * ABS(vec3::dot(axis, box_axes[0]))
+        + half_lengths.y * ABS(vec3::dot(axis, box_axes[1]))
+        + half_lengths.z * ABS(vec3::dot(axis, box_axes[2]));
+}
 
-    axes[3] = vec3(transformation2.m[0], transformation2.m[4], transformation2.m[8]).normalize();
-    axes[4] = vec3(transformation2.m[1], transformation2.m[5], transformation2.m[9]).normalize();
-    axes[5] = vec3(transformation2.m[2], transformation2.m[6], transformation2.m[10]).normalize();
+/*
+ * Overlap of the two boxes' projections onto SAT axis i, negative when the axis separates
+ * them. The axis is normalized and written to axis_out. Returns FLT_MAX for an edge axis
+ * from nearly parallel edges, the face axes cover that case.
+ */
+static float get_axis_penetration(int i, const vec3 *axes1, const vec3 &half_lengths1, const vec3 *axes2,
+        const vec3 &half_lengths2, const vec3 &center_offset, vec3 *axis_out) {
+    vec3 axis;
+
+    if (i < 3) {
+        axis = axes1[i];
+    }
+    else if (i < 6) {
+        axis = axes2[i - 3];
+    }
+    else {
+        axis = vec3::cross(axes1[(i - 6) / 3], axes2[(i - 6) % 3]);
+        if (axis.length_squared() < 0.000001) {
+            return FLT_MAX;
+        }
+        axis = axis.normalize();
+    }
 
-    axes[6] = vec3::cross(axes[0], axes[3]).normalize();
-    axes[7] = vec3::cross(axes[0], axes[4]).normalize();
-    axes[8] = vec3::cross(axes[0], axes[5]).normalize();
+    *axis_out = axis;
 
-    axes[9] = vec3::cross(axes[1], axes[3]).normalize();
-    axes[10] = vec3::cross(axes[1], axes[4]).normalize();
-    axes[11] = vec3::cross(axes[1], axes[5]).normalize();
+    float radius1 = get_projected_radius(axis, axes1, half_lengths1);
+    float radius2 = get_projected_radius(axis, axes2, half_lengths2);
+    return radius1 + radius2 - ABS(vec3::dot(center_offset, axis));
+}
 
-    axes[12] = vec3::cross(axes[2], axes[3]).normalize();
-    axes[13] = vec3::cross(axes[2], axes[4]).normalize();
-    axes[14] = vec3::cross(axes[2], axes[5]).normalize();
+/*
+ * Separating axis test over the 3 face normals of each box and the 9 edge cross products.
+ * The axis cached for the pair is tried first, so a pair that stays apart costs one axis a
+ * step. Faces are preferred over edges, and this box's faces over the other's, unless the
+ * other axis is clearly shallower, so the chosen feature does not flicker between nearly
+ * equal axes. Face contacts clip the incident face of one box against the side planes of
+ * the reference face of the other, edge contacts take the closest points of the two edges.
+ * A gap of up to margin along an axis does not count as separating, the axis with the
+ * widest gap then gives the speculative contacts.
+ */
+void BoxCollider::collide_with(BoxCollider *collider, float margin, PairCache *cache, ContactManifold *manifold) {
+    manifold->collider1 = collider;
+    manifold->collider2 = this;
 
-    float smallest_penetration = FLT_MAX;
-    int smallest_penetration_case = -1;
+    RigidBody body1 = this->body;
+    RigidBody body2 = collider->body;
 
-    for (int i = 0; i < 15; i++) {
-        vec3 axis = axes[i];
+    mat3 transformation1 = body1.orientation().get_rotation();
+    mat3 transformation2 = body2.orientation().get_rotation();
 
-        if (axis.length() < 0.0001) {
-            continue;
-        }
+    vec3 box1_axes[3];
+    vec3 box2_axes[3];
+    for (int i = 0; i < 3; i++) {
+        box1_axes[i] = transformation1.column(i).normalize();
+        box2_axes[i] = transformation2.column(i).normalize();
+    }
+
+    vec3 center_offset = body2.position() - body1.position();
+    vec3 axes[15];
+    float penetrations[15];
 
-        vec3 box1_points[8];
-        this->get_points(box1_points);
-        float i1_min = vec3::dot(box1_points[0], axis);
-        float i1_max = vec3::dot(box1_points[0], axis);
-        for (int j = 1; j < 8; j++) {
-            i1_min = MIN(vec3::dot(box1_points[j], axis), i1_min);
-            i1_max = MAX(vec3::dot(box1_points[j], axis), i1_max);
+    if (cache->axis != -1) {
+        float penetration = get_axis_penetration(cache->axis, box1_axes, half_lengths, box2_axes,
+                collider->half_lengths, center_offset, &axes[cache->axis]);
+        if (penetration < -margin) {
+            return;
         }
+    }
+
+    for (int i = 0; i < 15; i++) {
+        penetrations[i] = get_axis_penetration(i, box1_axes, half_lengths, box2_axes,
+                collider->half_lengths, center_offset, &axes[i]);
 
-        vec3 box2_points[8];
-        collider->get_points(box2_points);
-        float i2_min = vec3::dot(box2_points[0], axis);
-        float i2_max = vec3::dot(box2_points[0], axis);
-        for (int j = 1; j < 8; j++) {
-            i2_min = MIN(vec3::dot(box2_points[j], axis), i2_min);
-            i2_max = MAX(vec3::dot(box2_points[j], axis), i2_max);
+        if (penetrations[i] < -margin) {
+            cache->axis = i;
+            return;
         }
+    }
 
-        if (i1_min > i2_max || i2_min > i1_max) {
-            return manifold;
+    int best_axes[3] = { 0, 3, 6 };
+    for (int i = 0; i < 15; i++) {
+        int group = i < 3 ? 0 : (i < 6 ? 1 : 2);
+        if (penetrations[i] < penetrations[best_axes[group]]) {
+            best_axes[group] = i;
         }
+    }
 
-        float i1_length = i1_max - i1_min;
-        float i2_length = i2_max - i2_min;
-        float total_length = MAX(i1_max, i2_max) - MIN(i1_min, i2_min);
+    int axis_case = best_axes[0];
+    if (penetrations[best_axes[1]] < 0.95 * penetrations[axis_case] - 0.01) {
+        axis_case = best_axes[1];
+    }
+    if (penetrations[best_axes[2]] < 0.95 * penetrations[axis_case] - 0.01) {
+        axis_case = best_axes[2];
+    }
 
-        float penetration = i1_length + i2_length - total_length;
+    cache->axis = axis_case;
 
-        if (penetration < smallest_penetration) {
-            smallest_penetration = penetration;
-            smallest_penetration_case = i;
-        }
+    /*
+     * n points from this box to the other one, the manifold normal the other way round.
+     */
+    vec3 n = axes[axis_case];
+    if (vec3::dot(n, center_offset) < 0.0) {
+        n = -1.0 * n;
     }
 
-    std::vector<vec3> contact_points;
-    line_segment box_edges[12];
+    Contact contacts[16];
+    int num_contacts = 0;
 
-    this->get_edges(box_edges); 
-    collider->clip_edges(box_edges, &contact_points);
+    if (axis_case < 6) {
+        BoxCollider *reference = axis_case < 3 ? this : collider;
+        BoxCollider *incident = axis_case < 3 ? collider : this;
+        vec3 reference_normal = axis_case < 3 ? n : -1.0 * n;
 
-    collider->get_edges(box_edges);
-    this->clip_edges(box_edges, &contact_points);
+        vec3 reference_face[4];
+        int reference_face_id = reference->get_face(reference_normal, reference_face);
+        int reference_axis = reference_face_id / 2;
 
-    std::vector<vec3> unique_contact_points;
-    for (int i = 0; i < contact_points.size(); i++) {
-        for (int j = i + 1; j < contact_points.size(); j++) {
-            if ((contact_points[i] - contact_points[j]).length_squared() < 0.001) {
-                break;
-            }
+        vec3 polygon[16];
+        vec3 clipped[16];
+        int num_vertices = 4;
+        incident->get_face(-1.0 * reference_normal, polygon);
+
+        mat3 reference_rotation = reference->body.orientation().get_rotation();
+        vec3 reference_center = reference->body.position();
 
-            if (j == contact_points.size() - 1) {
-                unique_contact_points.push_back(contact_points[i]);
+        for (int i = 1; i < 3 && num_vertices > 0; i++) {
+            int side_axis = (reference_axis + i) % 3;
+            vec3 side = reference_rotation.column(side_axis);
+            float center_offset = vec3::dot(side, reference_center);
+            float half_length = reference->half_lengths[side_axis];
+
+            num_vertices = clip_polygon(polygon, num_vertices, side, center_offset + half_length, clipped);
+            num_vertices = clip_polygon(clipped, num_vertices, -1.0 * side, -center_offset + half_length, polygon);
+        }
+
+        float face_offset = vec3::dot(reference_normal, reference_face[0]);
+
+        for (int i = 0; i < num_vertices; i++) {
+            float separation = vec3::dot(reference_normal, polygon[i]) - face_offset;
+            if (separation > margin) {
+                continue;
             }
+
+            Contact contact;
+            contact.position = polygon[i] - (0.5 * separation) * reference_normal;
+            contact.penetration = -separation;
+            contacts[num_contacts++] = contact;
         }
     }
+    else {
+        int edge1_axis = (axis_case - 6) / 3;
+        int edge2_axis = (axis_case - 6) % 3;
 
-    for (int i = 0; i < unique_contact_points.size(); i++) {
-        Contact contact; 
-        contact.position = unique_contact_points[i];
-        contact.normal = axes[smallest_penetration_case];
-        if (vec3::dot(contact.normal, body2.position - body1.position) > 0) {
-            contact.normal = -1.0 * contact.normal;
-        }
-        contact.penetration = smallest_penetration;
+        line_segment edge1 = this->get_support_edge(edge1_axis, n);
+        line_segment edge2 = collider->get_support_edge(edge2_axis, -1.0 * n);
 
-        vec3 relative_velocity = (body2.velocity + vec3::cross(body2.angular_velocity, contact.position - body2.position)) 
-            - (body1.velocity + vec3::cross(body1.angular_velocity, contact.position - body1.position));
-        contact.is_resting_contact = relative_velocity.length_squared() < 0.01;
+        vec3 point1, point2;
+        closest_points_on_segments(edge1, edge2, &point1, &point2);
 
-        manifold.contacts.push_back(contact);
+        Contact contact;
+        contact.position = 0.5 * (point1 + point2);
+        contact.penetration = penetrations[axis_case];
+        contacts[num_contacts++] = contact;
     }
 
-    return manifold;
+    num_contacts = reduce_contacts(contacts, num_contacts, n);
+
+    for (int i = 0; i < num_contacts; i++) {
+        Contact contact = contacts[i];
+        contact.normal = -1.0 * n;
+
+        vec3 relative_velocity = (body2.velocity() + vec3::cross(body2.angular_velocity(), contact.position - body2.position()))
+            - (body1.velocity() + vec3::cross(body1.angular_velocity(), contact.position - body1.position()));
+        contact.is_resting_contact = relative_velocity.length_squared() < 0.01;
+
+        manifold->add_contact(contact);
+    }
 }
 
-ContactManifold BoxCollider::collide_with(PlaneCollider *collider) {
-    ContactManifold manifold;
-    manifold.collider1 = this;
-    manifold.collider2 = collider;
+void BoxCollider::collide_with(PlaneCollider *collider, float margin, PairCache *cache, ContactManifold *manifold) {
+    manifold->collider1 = this;
+    manifold->collider2 = collider;
 
-    mat4 transformation = mat4::translation(body.position) * body.orientation.get_matrix();
+    rigid_transform transformation = body.get_transform();
 
     vec3 points[8] = {
         vec3( half_lengths.x,   half_lengths.y,   half_lengths.z),
@@ -292,28 +512,42 @@ ContactManifold BoxCollider::collide_with(PlaneCollider *collider) {
         vec3(-half_lengths.x,  -half_lengths.y,  -half_lengths.z),
     };
 
+    Contact contacts[8];
+    int num_contacts = 0;
+
     for (int i = 0; i < 8; i++) {
-        vec3 point_world = transformation * points[i];
+        vec3 point_world = transformation.transform_point(points[i]);
 
-        if (point_world.y <= 0) {
+        if (point_world.y <= margin) {
             Contact contact;
             contact.position = point_world;
             contact.normal = vec3(0.0, -1.0, 0.0);
             contact.penetration = -1.0 * point_world.y;
             contact.is_resting_contact = false;
+            contact.feature_id = i;
 
-            manifold.contacts.push_back(contact);
+            contacts[num_contacts++] = contact;
         }
     }
 
-    return manifold;
+    num_contacts = reduce_contacts(contacts, num_contacts, vec3(0.0, -1.0, 0.0));
+
+    for (int i = 0; i < num_contacts; i++) {
+        manifold->add_contact(contacts[i]);
+    }
 }
 
 bool BoxCollider::intersect(ray r, float *t_out) {
-    mat4 inv_orientation_matrix = body.orientation.get_matrix().inverse();
+    return intersect(r, body.get_transform(), t_out);
+}
 
-    vec3 ro = inv_orientation_matrix * (r.origin - body.position);
-    vec3 rd = inv_orientation_matrix * r.direction;
+/*
+ * Slab test in the box's own frame. transformation is the box's current transform, taken
+ * as an argument so a batch of rays can build it once per box.
+ */
+bool BoxCollider::intersect(ray r, const rigid_transform &transformation, float *t_out) {
+    vec3 ro = transformation.inverse_transform_point(r.origin);
+    vec3 rd = transformation.inverse_transform_vector(r.direction);
 
     vec3 min = -1.0 * half_lengths;
     vec3 max = half_lengths;
@@ -370,83 +604,296 @@ bool BoxCollider::intersect(ray r, float *t_out) {
     return true;
 }
 
-void PlaneCollider::update_transform(Transform *transform) {
-    transform->scale = vec3(100.0, 1.0, 100.0);
-    transform->translation = vec3(0.0, -0.01, 0.0);
+aabb BoxCollider::get_aabb() {
+    mat3 transformation = body.orientation().get_rotation();
+    const float *m = transformation.m;
+
+    vec3 extent;
+    extent.x = ABS(m[0]) * half_lengths.x + ABS(m[1]) * half_lengths.y + ABS(m[2]) * half_lengths.z;
+    extent.y = ABS(m[3]) * half_lengths.x + ABS(m[4]) * half_lengths.y + ABS(m[5]) * half_lengths.z;
+    extent.z = ABS(m[6]) * half_lengths.x + ABS(m[7]) * half_lengths.y + ABS(m[8]) * half_lengths.z;
+
+    return aabb(body.position() - extent, body.position() + extent);
 }
 
-ContactManifold PlaneCollider::collide(Collider *collider) {
-    return collider->collide_with(this);
+float BoxCollider::get_bounding_radius() {
+    return half_lengths.length();
 }
 
-ContactManifold PlaneCollider::collide_with(SphereCollider *collider) {
-    return collider->collide_with(this);
+float BoxCollider::get_inner_radius() {
+    return MIN(half_lengths.x, MIN(half_lengths.y, half_lengths.z));
 }
 
-ContactManifold PlaneCollider::collide_with(BoxCollider *collider) {
-    return collider->collide_with(this);
+PlaneCollider::PlaneCollider() {
+    shape = SHAPE_PLANE;
 }
 
-ContactManifold PlaneCollider::collide_with(PlaneCollider *collider) {
-    return ContactManifold();
+void PlaneCollider::set_transform(Transform *transform, const vec3 &position, const quat &orientation) {
+    transform->scale = vec3(100.0, 1.0, 100.0);
+    transform->translation = vec3(0.0, -0.01, 0.0);
 }
 
 bool PlaneCollider::intersect(ray r, float *t_out) {
     return false;
 }
 
-void SphereCollider::update_transform(Transform *transform) {
-    transform->scale = vec3(radius, radius, radius);
-    transform->translation = body.position;
-    transform->orientation = body.orientation;
+/*
+ * The plane is the infinite ground plane y = 0, so its box spans every other box in x and z.
+ */
+aabb PlaneCollider::get_aabb() {
+    return aabb(vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX), vec3(FLT_MAX, 0.0, FLT_MAX));
 }
 
-ContactManifold SphereCollider::collide(Collider *collider) {
-    return collider->collide_with(this);
+float PlaneCollider::get_bounding_radius() {
+    return FLT_MAX;
 }
 
-ContactManifold SphereCollider::collide_with(SphereCollider *collider) {
-    ContactManifold manifold;
-    manifold.collider1 = this;
-    manifold.collider2 = collider;
+float PlaneCollider::get_inner_radius() {
+    return FLT_MAX;
+}
+
+SphereCollider::SphereCollider() {
+    shape = SHAPE_SPHERE;
+}
+
+void SphereCollider::set_transform(Transform *transform, const vec3 &position, const quat &orientation) {
+    transform->scale = vec3(radius, radius, radius);
+    transform->translation = position;
+    transform->orientation = orientation;
+}
 
-    vec3 v1 = this->body.position;
-    vec3 v2 = collider->body.position;
+void SphereCollider::collide_with(SphereCollider *collider, float margin, PairCache *cache, ContactManifold *manifold) {
+    manifold->collider1 = this;
+    manifold->collider2 = collider;
+
+    vec3 v1 = this->body.position();
+    vec3 v2 = collider->body.position();
     vec3 r = v2 - v1;
 
-    if (r.length() > collider->radius + this->radius) {
-        return manifold;
+    if (r.length() > collider->radius + this->radius + margin) {
+        return;
     }
 
     Contact contact;
     contact.normal = r.normalize();
     contact.penetration = (collider->radius + this->radius) - r.length();
     contact.position = v1 + this->radius * contact.normal;
-    manifold.contacts.push_back(contact);
+    contact.feature_id = 0;
+    manifold->add_contact(contact);
+}
+
+void SphereCollider::collide_with(PlaneCollider *collider, float margin, PairCache *cache, ContactManifold *manifold) {
+    manifold->collider1 = this;
+    manifold->collider2 = collider;
+
+    if (body.position().y - radius < margin) {
+        Contact contact;
+        contact.position = vec3(body.position().x, body.position().y - radius, body.position().z);
+        contact.normal = vec3(0.0, -1.0, 0.0);
+        contact.penetration = -(body.position().y - radius);
+        contact.feature_id = 0;
+        manifold->add_contact(contact);
+    }
+}
 
-    return manifold;
+bool SphereCollider::intersect(ray r, float *t_out) {
+    return r.intersect_sphere(body.position(), radius, t_out);
 }
 
-ContactManifold SphereCollider::collide_with(BoxCollider *collider) {
-    return collider->collide_with(this);
+aabb SphereCollider::get_aabb() {
+    vec3 extent = vec3(radius, radius, radius);
+    return aabb(body.position() - extent, body.position() + extent);
 }
 
-ContactManifold SphereCollider::collide_with(PlaneCollider *collider) {
-    ContactManifold manifold;
-    manifold.collider1 = this;
-    manifold.collider2 = collider;
+float SphereCollider::get_bounding_radius() {
+    return radius;
+}
 
-    if (body.position.y - radius < 0.0) {
-        Contact contact;
-        contact.position = vec3(body.position.x, body.position.y - radius, body.position.z);
-        contact.normal = vec3(0.0, -1.0, 0.0);
-        contact.penetration = -(body.position.y - radius);
-        manifold.contacts.push_back(contact);
+float SphereCollider::get_inner_radius() {
+    return radius;
+}
+
+/*
+ * The kernels keep the argument order the pairs have always been tested in, so manifolds
+ * and their normals come out the same whichever way round the broadphase reports a pair.
+ */
+static void collide_sphere_sphere(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((SphereCollider*) collider2)->collide_with((SphereCollider*) collider1, margin, cache, manifold);
+}
+
+static void collide_sphere_box(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((BoxCollider*) collider2)->collide_with((SphereCollider*) collider1, margin, cache, manifold);
+}
+
+static void collide_sphere_plane(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((SphereCollider*) collider1)->collide_with((PlaneCollider*) collider2, margin, cache, manifold);
+}
+
+static void collide_box_sphere(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((BoxCollider*) collider1)->collide_with((SphereCollider*) collider2, margin, cache, manifold);
+}
+
+static void collide_box_box(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((BoxCollider*) collider2)->collide_with((BoxCollider*) collider1, margin, cache, manifold);
+}
+
+static void collide_box_plane(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((BoxCollider*) collider1)->collide_with((PlaneCollider*) collider2, margin, cache, manifold);
+}
+
+static void collide_plane_sphere(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((SphereCollider*) collider2)->collide_with((PlaneCollider*) collider1, margin, cache, manifold);
+}
+
+static void collide_plane_box(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold) {
+    ((BoxCollider*) collider2)->collide_with((PlaneCollider*) collider1, margin, cache, manifold);
+}
+
+CollideFunction collide_functions[NUM_SHAPES][NUM_SHAPES] = {
+    { collide_sphere_sphere, collide_sphere_box, collide_sphere_plane },
+    { collide_box_sphere, collide_box_box, collide_box_plane },
+    { collide_plane_sphere, collide_plane_box, NULL },
+};
+
+static float distance_sphere_sphere(Collider *collider1, Collider *collider2, vec3 *normal) {
+    SphereCollider *sphere1 = (SphereCollider*) collider1;
+    SphereCollider *sphere2 = (SphereCollider*) collider2;
+
+    vec3 d = sphere1->body.position() - sphere2->body.position();
+    float length = d.length();
+    *normal = length > 0.0 ? (1.0 / length) * d : vec3(0.0, 1.0, 0.0);
+
+    return length - sphere1->radius - sphere2->radius;
+}
+
+/*
+ * Outside the box the gap is along the line to the closest point on the box. With the
+ * center inside it is along the face normal it is least deep behind.
+ */
+static float distance_box_sphere(Collider *collider1, Collider *collider2, vec3 *normal) {
+    BoxCollider *box = (BoxCollider*) collider1;
+    SphereCollider *sphere = (SphereCollider*) collider2;
+
+    rigid_transform transformation = box->body.get_transform();
+    vec3 center = transformation.inverse_transform_point(sphere->body.position());
+    vec3 closest;
+    closest.x = MAX(-box->half_lengths.x, MIN(center.x, box->half_lengths.x));
+    closest.y = MAX(-box->half_lengths.y, MIN(center.y, box->half_lengths.y));
+    closest.z = MAX(-box->half_lengths.z, MIN(center.z, box->half_lengths.z));
+
+    vec3 d = center - closest;
+    float length = d.length();
+
+    if (length > 0.0) {
+        *normal = -1.0 * transformation.transform_vector((1.0 / length) * d);
+        return length - sphere->radius;
     }
 
-    return manifold;
+    float max_gap = -FLT_MAX;
+
+    for (int i = 0; i < 3; i++) {
+        float gap = ABS(center[i]) - box->half_lengths[i] - sphere->radius;
+
+        if (gap > max_gap) {
+            vec3 axis = transformation.rotation.column(i);
+            *normal = center[i] > 0.0 ? -1.0 * axis : axis;
+            max_gap = gap;
+        }
+    }
+
+    return max_gap;
 }
 
-bool SphereCollider::intersect(ray r, float *t_out) {
-    return r.intersect_sphere(body.position, radius, t_out);
+static float distance_sphere_box(Collider *collider1, Collider *collider2, vec3 *normal) {
+    float distance = distance_box_sphere(collider2, collider1, normal);
+    *normal = -1.0 * *normal;
+    return distance;
 }
+
+/*
+ * The largest gap between the boxes' projections onto the 15 SAT axes.
+ */
+static float distance_box_box(Collider *collider1, Collider *collider2, vec3 *normal) {
+    BoxCollider *box1 = (BoxCollider*) collider1;
+    BoxCollider *box2 = (BoxCollider*) collider2;
+
+    mat3 rotation1 = box1->body.orientation().get_rotation();
+    mat3 rotation2 = box2->body.orientation().get_rotation();
+    vec3 d = box2->body.position() - box1->body.position();
+
+    vec3 axes[15];
+    for (int i = 0; i < 3; i++) {
+        axes[i] = rotation1.column(i);
+        axes[3 + i] = rotation2.column(i);
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            axes[6 + 3 * i + j] = vec3::cross(axes[i], axes[3 + j]);
+        }
+    }
+
+    float max_gap = -FLT_MAX;
+
+    for (int i = 0; i < 15; i++) {
+        float length = axes[i].length();
+        if (length < 0.0001) {
+            continue;
+        }
+
+        vec3 axis = (1.0 / length) * axes[i];
+        float distance = vec3::dot(d, axis);
+        float r1 = 0.0, r2 = 0.0;
+
+        for (int k = 0; k < 3; k++) {
+            r1 += ABS(vec3::dot(axes[k], axis)) * box1->half_lengths[k];
+            r2 += ABS(vec3::dot(axes[3 + k], axis)) * box2->half_lengths[k];
+        }
+
+        float gap = ABS(distance) - r1 - r2;
+
+        if (gap > max_gap) {
+            *normal = distance > 0.0 ? -1.0 * axis : axis;
+            max_gap = gap;
+        }
+    }
+
+    return max_gap;
+}
+
+/*
+ * The plane is the ground y = 0, see PlaneCollider::get_aabb.
+ */
+static float distance_sphere_plane(Collider *collider1, Collider *collider2, vec3 *normal) {
+    SphereCollider *sphere = (SphereCollider*) collider1;
+
+    *normal = vec3(0.0, 1.0, 0.0);
+    return sphere->body.position().y - sphere->radius;
+}
+
+static float distance_plane_sphere(Collider *collider1, Collider *collider2, vec3 *normal) {
+    float distance = distance_sphere_plane(collider2, collider1, normal);
+    *normal = -1.0 * *normal;
+    return distance;
+}
+
+static float distance_box_plane(Collider *collider1, Collider *collider2, vec3 *normal) {
+    BoxCollider *box = (BoxCollider*) collider1;
+    mat3 rotation = box->body.orientation().get_rotation();
+    const float *m = rotation.m;
+
+    float extent = ABS(m[3]) * box->half_lengths.x + ABS(m[4]) * box->half_lengths.y + ABS(m[5]) * box->half_lengths.z;
+    *normal = vec3(0.0, 1.0, 0.0);
+    return box->body.position().y - extent;
+}
+
+static float distance_plane_box(Collider *collider1, Collider *collider2, vec3 *normal) {
+    float distance = distance_box_plane(collider2, collider1, normal);
+    *normal = -1.0 * *normal;
+    return distance;
+}
+
+DistanceFunction distance_functions[NUM_SHAPES][NUM_SHAPES] = {
+    { distance_sphere_sphere, distance_sphere_box, distance_sphere_plane },
+    { distance_box_sphere, distance_box_box, distance_box_plane },
+    { distance_plane_sphere, distance_plane_box, NULL },
+};
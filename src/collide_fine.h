@@ -5,69 +5,110 @@
 #include <vector>
 
 #include "rigid_body.h"
-#include "scene.h"
+#include "transform.h"
 
+#define MAX_MANIFOLD_CONTACTS 4
+
+class Collider;
 class ContactManifold;
 class BoxCollider;
 class PlaneCollider;
 class SphereCollider;
 
+enum ColliderShape {
+    SHAPE_SPHERE,
+    SHAPE_BOX,
+    SHAPE_PLANE,
+    NUM_SHAPES
+};
+
+/*
+ * What the narrowphase remembers about a pair from one step to the next. axis is the SAT
+ * axis that separated the pair, or had the least penetration, last step, -1 if unknown.
+ */
+struct PairCache {
+    int axis;
+
+    PairCache();
+};
+
+/*
+ * Narrowphase kernel for one pair of shapes, called with the pair's colliders in broadphase
+ * order. Parts of the shapes less than margin apart are reported as speculative contacts
+ * with negative penetration, at zero only touching and overlapping parts are.
+ */
+typedef void (*CollideFunction)(Collider *collider1, Collider *collider2, float margin, PairCache *cache, ContactManifold *manifold);
+
+/*
+ * Largest gap between two colliders at their current poses along any one direction,
+ * negative when they overlap, and that direction pointing from collider2 towards
+ * collider1. The gap is never more than the distance between them. Used to advance fast
+ * bodies to their time of impact.
+ */
+typedef float (*DistanceFunction)(Collider *collider1, Collider *collider2, vec3 *normal);
+
 class Collider {
     public:
         int id;
         int transform_id;
         int level;
+        ColliderShape shape;
         RigidBody body;
 
-        virtual void update_transform(Transform *transform) = 0;
-        virtual ContactManifold collide(Collider *collider) = 0;
-        virtual ContactManifold collide_with(SphereCollider *collider) = 0;   
-        virtual ContactManifold collide_with(BoxCollider *collider) = 0;   
-        virtual ContactManifold collide_with(PlaneCollider *collider) = 0;   
+        void update_transform(Transform *transform);
+        virtual void set_transform(Transform *transform, const vec3 &position, const quat &orientation) = 0;
         virtual bool intersect(ray r, float *t_out) = 0;
+        virtual aabb get_aabb() = 0;
+        virtual float get_bounding_radius() = 0;
+        virtual float get_inner_radius() = 0;
 };
 
 class SphereCollider : public Collider {
     public: 
         float radius;
 
-        virtual void update_transform(Transform *transform);
-        virtual ContactManifold collide(Collider *collider);
-        virtual ContactManifold collide_with(SphereCollider *collider);   
-        virtual ContactManifold collide_with(BoxCollider *collider);   
-        virtual ContactManifold collide_with(PlaneCollider *collider);   
+        SphereCollider();
+        virtual void set_transform(Transform *transform, const vec3 &position, const quat &orientation);
+        void collide_with(SphereCollider *collider, float margin, PairCache *cache, ContactManifold *manifold);
+        void collide_with(PlaneCollider *collider, float margin, PairCache *cache, ContactManifold *manifold);
         virtual bool intersect(ray r, float *t_out);
+        virtual aabb get_aabb();
+        virtual float get_bounding_radius();
+        virtual float get_inner_radius();
 };
 
 class BoxCollider : public Collider {
     private:
-        bool contains_point(const vec3 &p);
-        void get_points(vec3 *points);
-        void get_edges(line_segment *edges); 
-        void clip_edges(line_segment *edges, std::vector<vec3> *contact_points);
-        void get_planes(plane *planes);
+        int get_face(const vec3 &direction, vec3 *vertices);
+        line_segment get_support_edge(int axis, const vec3 &direction);
+        void collide_with_inside_sphere(SphereCollider *collider, const vec3 &center,
+                const rigid_transform &transformation, ContactManifold *manifold);
 
     public: 
         vec3 half_lengths;
 
-        virtual void update_transform(Transform *transform);
-        virtual ContactManifold collide(Collider *collider);
-        virtual ContactManifold collide_with(SphereCollider *collider);   
-        virtual ContactManifold collide_with(BoxCollider *collider);   
-        virtual ContactManifold collide_with(PlaneCollider *collider);   
+        BoxCollider();
+        virtual void set_transform(Transform *transform, const vec3 &position, const quat &orientation);
+        void collide_with(SphereCollider *collider, float margin, PairCache *cache, ContactManifold *manifold);
+        void collide_with(BoxCollider *collider, float margin, PairCache *cache, ContactManifold *manifold);
+        void collide_with(PlaneCollider *collider, float margin, PairCache *cache, ContactManifold *manifold);
         virtual bool intersect(ray r, float *t_out);
+        bool intersect(ray r, const rigid_transform &transformation, float *t_out);
+        virtual aabb get_aabb();
+        virtual float get_bounding_radius();
+        virtual float get_inner_radius();
 };
 
 class PlaneCollider : public Collider {
     public:
         vec3 normal;
 
-        virtual void update_transform(Transform *transform);
-        virtual ContactManifold collide(Collider *collider);
-        virtual ContactManifold collide_with(SphereCollider *collider);   
-        virtual ContactManifold collide_with(BoxCollider *collider);   
-        virtual ContactManifold collide_with(PlaneCollider *collider);   
+        PlaneCollider();
+        virtual void set_transform(Transform *transform, const vec3 &position, const quat &orientation);
         virtual bool intersect(ray r, float *t_out);
+        virtual aabb get_aabb();
+        virtual float get_bounding_radius();
+        virtual float get_inner_radius();
 };
 
 class Contact {
@@ -76,11 +117,39 @@ class Contact {
         vec3 normal;
         float penetration;
         bool is_resting_contact;
+        int feature_id;
+
+        vec3 r1, r2;
+        vec3 local_point1, local_point2;
+
+        float normal_impulse;
+        vec3 tangent_impulse;
+
+        Contact();
 };
 
+/*
+ * The contacts between two colliders. The narrowphase keeps at most four contacts per
+ * pair, so they are stored inline and a manifold never touches the heap.
+ */
 class ContactManifold {
     public:
         Collider *collider1;
         Collider *collider2;
-        std::vector<Contact> contacts;
+        Contact contacts[MAX_MANIFOLD_CONTACTS];
+        int num_contacts;
+
+        ContactManifold();
+        void add_contact(const Contact &contact);
 };
+
+/*
+ * The narrowphase kernel for each pair of shapes, indexed by the shapes of the pair's first
+ * and second collider. NULL for pairs that never collide.
+ */
+extern CollideFunction collide_functions[NUM_SHAPES][NUM_SHAPES];
+
+/*
+ * The distance function for each pair of shapes, NULL for pairs that never collide.
+ */
+extern DistanceFunction distance_functions[NUM_SHAPES][NUM_SHAPES];
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#define COLLIDER_POOL_CHUNK_SIZE 64
+
+/*
+ * Colliders of one shape, allocated COLLIDER_POOL_CHUNK_SIZE at a time so that pointers
+ * stay valid as the pool grows. Freed colliders go on a free list and are handed out again
+ * before a new chunk is started, so adding and removing at a steady rate stops allocating.
+ */
+template<typename T>
+class ColliderPool {
+    private:
+        std::vector<T*> chunks;
+        std::vector<T*> free_list;
+        int num_used_in_last_chunk;
+
+    public:
+        ColliderPool() {
+            num_used_in_last_chunk = COLLIDER_POOL_CHUNK_SIZE;
+        }
+
+        ~ColliderPool() {
+            for (int i = 0; i < chunks.size(); i++) {
+                delete[] chunks[i];
+            }
+        }
+
+        /*
+         * Returns a collider in its default state.
+         */
+        T *allocate() {
+            T *collider;
+
+            if (free_list.size() > 0) {
+                collider = free_list.back();
+                free_list.pop_back();
+            }
+            else {
+                if (num_used_in_last_chunk == COLLIDER_POOL_CHUNK_SIZE) {
+                    chunks.push_back(new T[COLLIDER_POOL_CHUNK_SIZE]);
+                    num_used_in_last_chunk = 0;
+                }
+
+                collider = &chunks.back()[num_used_in_last_chunk++];
+            }
+
+            *collider = T();
+            return collider;
+        }
+
+        void free(T *collider) {
+            free_list.push_back(collider);
+        }
+
+        /*
+         * Colliders the pool holds, in use or free.
+         */
+        int get_capacity() {
+            return chunks.size() * COLLIDER_POOL_CHUNK_SIZE;
+        }
+};
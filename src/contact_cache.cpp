@@ -0,0 +1,141 @@
+#include <algorithm>
+
+#include "contact_cache.h"
+
+static bool manifold_less_than(const CachedManifold &m1, const CachedManifold &m2) {
+    return m1.key < m2.key;
+}
+
+ContactCache::ContactCache() {
+    match_distance = 0.05;
+    num_matched_contacts = 0;
+}
+
+long long ContactCache::get_key(Collider *collider1, Collider *collider2) {
+    return ((long long) collider1->id << 32) | (unsigned int) collider2->id;
+}
+
+int ContactCache::find_manifold(long long key) {
+    int low = 0;
+    int high = manifolds.size() - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+
+        if (manifolds[mid].key == key) {
+            return mid;
+        }
+
+        if (manifolds[mid].key < key) {
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+void ContactCache::store(const std::vector<ContactManifold> &new_manifolds) {
+    manifolds.clear();
+    contacts.clear();
+
+    for (int i = 0; i < new_manifolds.size(); i++) {
+        const ContactManifold *manifold = &new_manifolds[i];
+
+        CachedManifold cached_manifold;
+        cached_manifold.key = get_key(manifold->collider1, manifold->collider2);
+        cached_manifold.first_contact = contacts.size();
+        cached_manifold.num_contacts = manifold->num_contacts;
+        manifolds.push_back(cached_manifold);
+
+        for (int j = 0; j < manifold->num_contacts; j++) {
+            const Contact *contact = &manifold->contacts[j];
+
+            CachedContact cached_contact;
+            cached_contact.local_point1 = contact->local_point1;
+            cached_contact.local_point2 = contact->local_point2;
+            cached_contact.feature_id = contact->feature_id;
+            cached_contact.normal_impulse = contact->normal_impulse;
+            cached_contact.tangent_impulse = contact->tangent_impulse;
+            contacts.push_back(cached_contact);
+        }
+    }
+
+    std::sort(manifolds.begin(), manifolds.end(), manifold_less_than);
+}
+
+/*
+ * Contacts with a feature id match the cached contact with the same id. The others match
+ * the closest cached contact whose anchors on both bodies are within match_distance. The
+ * new contacts must already have their local points set.
+ */
+void ContactCache::match(std::vector<ContactManifold> *new_manifolds) {
+    num_matched_contacts = 0;
+
+    float max_distance_squared = match_distance * match_distance;
+
+    for (int i = 0; i < new_manifolds->size(); i++) {
+        ContactManifold *manifold = &(*new_manifolds)[i];
+
+        int cached_index = find_manifold(get_key(manifold->collider1, manifold->collider2));
+        if (cached_index == -1) {
+            continue;
+        }
+
+        CachedManifold *cached_manifold = &manifolds[cached_index];
+
+        for (int j = 0; j < manifold->num_contacts; j++) {
+            Contact *contact = &manifold->contacts[j];
+            CachedContact *match = NULL;
+            float min_distance_squared = max_distance_squared;
+
+            for (int k = 0; k < cached_manifold->num_contacts; k++) {
+                CachedContact *cached_contact = &contacts[cached_manifold->first_contact + k];
+
+                if (contact->feature_id != -1 && cached_contact->feature_id != -1) {
+                    if (contact->feature_id == cached_contact->feature_id) {
+                        match = cached_contact;
+                        break;
+                    }
+                    continue;
+                }
+
+                float d1 = (contact->local_point1 - cached_contact->local_point1).length_squared();
+                float d2 = (contact->local_point2 - cached_contact->local_point2).length_squared();
+                float d = MAX(d1, d2);
+                if (d < min_distance_squared) {
+                    min_distance_squared = d;
+                    match = cached_contact;
+                }
+            }
+
+            if (match) {
+                contact->normal_impulse = match->normal_impulse;
+                contact->tangent_impulse = match->tangent_impulse
+                    - vec3::dot(match->tangent_impulse, contact->normal) * contact->normal;
+                num_matched_contacts++;
+            }
+        }
+    }
+}
+
+/*
+ * Forgets the manifolds of a removed collider so a new collider that gets its id does not
+ * pick up its impulses. The cached contacts themselves are dropped at the next store.
+ */
+void ContactCache::remove_collider(int collider_id) {
+    int num_kept = 0;
+
+    for (int i = 0; i < manifolds.size(); i++) {
+        int id1 = manifolds[i].key >> 32;
+        int id2 = (int) (manifolds[i].key & 0xffffffff);
+
+        if (id1 != collider_id && id2 != collider_id) {
+            manifolds[num_kept++] = manifolds[i];
+        }
+    }
+
+    manifolds.resize(num_kept);
+}
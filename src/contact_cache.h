@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "collide_fine.h"
+
+struct CachedContact {
+    vec3 local_point1, local_point2;
+    int feature_id;
+    float normal_impulse;
+    vec3 tangent_impulse;
+};
+
+struct CachedManifold {
+    long long key;
+    int first_contact;
+    int num_contacts;
+};
+
+/*
+ * Keeps the contacts of the last step, keyed by (collider1 id, collider2 id), so that the
+ * impulses the solver accumulated can be carried over to the matching contacts of the
+ * next step.
+ */
+class ContactCache {
+    private:
+        std::vector<CachedManifold> manifolds;
+        std::vector<CachedContact> contacts;
+
+        int find_manifold(long long key);
+
+    public:
+        float match_distance;
+        int num_matched_contacts;
+
+        ContactCache();
+        void store(const std::vector<ContactManifold> &new_manifolds);
+        void match(std::vector<ContactManifold> *new_manifolds);
+        void remove_collider(int collider_id);
+
+        static long long get_key(Collider *collider1, Collider *collider2);
+};
@@ -0,0 +1,500 @@
+#include <math.h>
+
+#include "contact_solver.h"
+
+static float get_effective_mass(float inv_mass_sum, const vec3 &r1, const vec3 &angular1,
+        const vec3 &r2, const vec3 &angular2) {
+    float k = inv_mass_sum + vec3::dot(r1, angular1) + vec3::dot(r2, angular2);
+
+    if (k == 0.0) {
+        return 0.0;
+    }
+
+    return 1.0 / k;
+}
+
+/*
+ * Applies the impulse lambda along a direction whose arms and angular responses were
+ * precomputed for both bodies.
+ */
+static void apply_constraint_impulse(RigidBodyStore *bodies, ContactConstraint *c, const vec3 &direction,
+        const vec3 &angular1, const vec3 &angular2, float lambda) {
+    int b1 = c->body1_id;
+    int b2 = c->body2_id;
+
+    /*
+     * Static bodies are shared between islands solved on different threads, so they must
+     * not even be written with an unchanged value.
+     */
+    if (!bodies->static_flags[b1]) {
+        bodies->velocities[b1] = bodies->velocities[b1] - (lambda * c->inv_mass_1) * direction;
+        bodies->angular_velocities[b1] = bodies->angular_velocities[b1] - lambda * angular1;
+    }
+
+    if (!bodies->static_flags[b2]) {
+        bodies->velocities[b2] = bodies->velocities[b2] + (lambda * c->inv_mass_2) * direction;
+        bodies->angular_velocities[b2] = bodies->angular_velocities[b2] + lambda * angular2;
+    }
+}
+
+static float get_relative_velocity(RigidBodyStore *bodies, ContactConstraint *c, const vec3 &direction,
+        const vec3 &r1, const vec3 &r2) {
+    int b1 = c->body1_id;
+    int b2 = c->body2_id;
+
+    return vec3::dot(bodies->velocities[b2] - bodies->velocities[b1], direction)
+        + vec3::dot(bodies->angular_velocities[b2], r2) - vec3::dot(bodies->angular_velocities[b1], r1);
+}
+
+/*
+ * How far the contact's anchor points on the two bodies are apart along the normal, given
+ * where the bodies are now. The anchors coincide when the contact is found, so this starts
+ * out as minus the penetration.
+ */
+static float get_separation(RigidBodyStore *bodies, ContactConstraint *c) {
+    int b1 = c->body1_id;
+    int b2 = c->body2_id;
+    Contact *contact = c->contact;
+
+    vec3 point1 = bodies->positions[b1] + bodies->orientations[b1].get_rotation() * contact->local_point1;
+    vec3 point2 = bodies->positions[b2] + bodies->orientations[b2].get_rotation() * contact->local_point2;
+    return vec3::dot(point2 - point1, c->normal) - contact->penetration;
+}
+
+ContactSolver::ContactSolver() {
+    bodies = NULL;
+    manifolds = NULL;
+    island_builder = NULL;
+    arena = NULL;
+    inv_dt = 0.0;
+    constraints = NULL;
+    island_first_constraint = NULL;
+    island_num_constraints = NULL;
+    sorted_constraints = NULL;
+    body_colors = NULL;
+    constraint_colors = NULL;
+    batch_starts = NULL;
+    batch_next = NULL;
+    num_batches = 0;
+    split_threshold = 2048;
+    batch_grain_size = 256;
+}
+
+/*
+ * Lays out one contiguous range of constraints per island. The contacts must have their
+ * arms set and their impulses loaded from the contact cache. Manifolds between two static
+ * bodies get no constraints, here or in init_island.
+ */
+void ContactSolver::init(RigidBodyStore *bodies, std::vector<ContactManifold> *manifolds, IslandBuilder *island_builder, FrameArena *arena, float dt) {
+    this->bodies = bodies;
+    this->manifolds = manifolds;
+    this->island_builder = island_builder;
+    this->arena = arena;
+    inv_dt = 1.0 / dt;
+
+    int num_islands = island_builder->num_islands;
+    island_first_constraint = arena->allocate<int>(num_islands);
+    island_num_constraints = arena->allocate<int>(num_islands);
+
+    int num_constraints = 0;
+    for (int i = 0; i < num_islands; i++) {
+        Island *island = &island_builder->islands[i];
+
+        island_first_constraint[i] = num_constraints;
+        island_num_constraints[i] = 0;
+
+        for (int j = 0; j < island->num_manifolds; j++) {
+            ContactManifold *manifold = &(*manifolds)[island_builder->manifold_ids[island->first_manifold + j]];
+            int b1 = manifold->collider1->body.id;
+            int b2 = manifold->collider2->body.id;
+
+            if (bodies->static_flags[b1] && bodies->static_flags[b2]) {
+                continue;
+            }
+
+            island_num_constraints[i] += manifold->num_contacts;
+        }
+
+        num_constraints += island_num_constraints[i];
+    }
+
+    constraints = arena->allocate<ContactConstraint>(num_constraints);
+}
+
+bool ContactSolver::is_split_island(int island_id) {
+    return island_num_constraints[island_id] > split_threshold;
+}
+
+/*
+ * Builds the constraints of one island and applies their warm start impulses. Only touches
+ * the island's own constraints and bodies, so islands can be initialized in parallel.
+ */
+void ContactSolver::init_island(int island_id, bool warm_start) {
+    Island *island = &island_builder->islands[island_id];
+    int first_constraint = island_first_constraint[island_id];
+    int next_constraint = first_constraint;
+
+    for (int i = 0; i < island->num_manifolds; i++) {
+        ContactManifold *manifold = &(*manifolds)[island_builder->manifold_ids[island->first_manifold + i]];
+
+        int b1 = manifold->collider1->body.id;
+        int b2 = manifold->collider2->body.id;
+
+        if (bodies->static_flags[b1] && bodies->static_flags[b2]) {
+            continue;
+        }
+
+        mat3 i1 = manifold->collider1->body.get_inv_inertia_tensor();
+        mat3 i2 = manifold->collider2->body.get_inv_inertia_tensor();
+
+        float inv_mass_1 = bodies->inv_masses[b1];
+        float inv_mass_2 = bodies->inv_masses[b2];
+        float inv_mass_sum = inv_mass_1 + inv_mass_2;
+
+        float e = MIN(bodies->restitutions[b1], bodies->restitutions[b2]);
+        float friction = sqrt(bodies->frictions[b1] * bodies->frictions[b2]);
+
+        for (int j = 0; j < manifold->num_contacts; j++) {
+            Contact *contact = &manifold->contacts[j];
+            vec3 r1 = contact->r1;
+            vec3 r2 = contact->r2;
+
+            ContactConstraint c;
+            c.body1_id = b1;
+            c.body2_id = b2;
+            c.contact = contact;
+            c.inv_mass_1 = inv_mass_1;
+            c.inv_mass_2 = inv_mass_2;
+            c.friction = friction;
+            c.normal = contact->normal;
+
+            vec3 relative_velocity = (bodies->velocities[b2] + vec3::cross(bodies->angular_velocities[b2], r2))
+                - (bodies->velocities[b1] + vec3::cross(bodies->angular_velocities[b1], r1));
+            float normal_velocity = vec3::dot(relative_velocity, c.normal);
+
+            /*
+             * Line the first tangent up with the sliding direction when there is one, so
+             * the friction pyramid matches the cone where it matters.
+             */
+            vec3 tangent_velocity = relative_velocity - normal_velocity * c.normal;
+            if (tangent_velocity.length_squared() > 0.001) {
+                c.tangent1 = tangent_velocity.normalize();
+            }
+            else if (ABS(c.normal.x) < 0.57735) {
+                c.tangent1 = vec3::cross(c.normal, vec3(1.0, 0.0, 0.0)).normalize();
+            }
+            else {
+                c.tangent1 = vec3::cross(c.normal, vec3(0.0, 1.0, 0.0)).normalize();
+            }
+            c.tangent2 = vec3::cross(c.normal, c.tangent1);
+
+            c.rn1 = vec3::cross(r1, c.normal);
+            c.rn2 = vec3::cross(r2, c.normal);
+            c.rt1_1 = vec3::cross(r1, c.tangent1);
+            c.rt1_2 = vec3::cross(r2, c.tangent1);
+            c.rt2_1 = vec3::cross(r1, c.tangent2);
+            c.rt2_2 = vec3::cross(r2, c.tangent2);
+
+            c.angular_normal1 = i1 * c.rn1;
+            c.angular_normal2 = i2 * c.rn2;
+            c.angular_tangent1_1 = i1 * c.rt1_1;
+            c.angular_tangent1_2 = i2 * c.rt1_2;
+            c.angular_tangent2_1 = i1 * c.rt2_1;
+            c.angular_tangent2_2 = i2 * c.rt2_2;
+
+            c.normal_mass = get_effective_mass(inv_mass_sum, c.rn1, c.angular_normal1, c.rn2, c.angular_normal2);
+            c.tangent_mass1 = get_effective_mass(inv_mass_sum, c.rt1_1, c.angular_tangent1_1, c.rt1_2, c.angular_tangent1_2);
+            c.tangent_mass2 = get_effective_mass(inv_mass_sum, c.rt2_1, c.angular_tangent2_1, c.rt2_2, c.angular_tangent2_2);
+
+            c.bias = 0.0;
+            if (normal_velocity < -RESTITUTION_VELOCITY_THRESHOLD) {
+                c.bias = -e * normal_velocity;
+            }
+
+            /*
+             * A speculative contact lets the bodies approach until the gap closes at the
+             * end of the step. If they would hit hard enough to bounce, they spend the part
+             * of the step after the hit moving apart.
+             */
+            c.step_bias = c.bias;
+            if (contact->penetration < 0.0) {
+                float closing_bias = contact->penetration * inv_dt;
+                c.step_bias = closing_bias;
+                if (normal_velocity < -RESTITUTION_VELOCITY_THRESHOLD && normal_velocity < closing_bias) {
+                    c.step_bias = (1.0 + e) * closing_bias - e * normal_velocity;
+                }
+            }
+
+            if (warm_start) {
+                c.normal_impulse = contact->normal_impulse;
+                c.tangent_impulse1 = vec3::dot(contact->tangent_impulse, c.tangent1);
+                c.tangent_impulse2 = vec3::dot(contact->tangent_impulse, c.tangent2);
+            }
+            else {
+                c.normal_impulse = 0.0;
+                c.tangent_impulse1 = 0.0;
+                c.tangent_impulse2 = 0.0;
+            }
+
+            constraints[next_constraint++] = c;
+        }
+    }
+
+    if (warm_start) {
+        warm_start_range(first_constraint, next_constraint);
+    }
+}
+
+/*
+ * Applies the impulses the constraints have accumulated so far.
+ */
+void ContactSolver::warm_start_range(int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        ContactConstraint *c = &constraints[i];
+        apply_constraint_impulse(bodies, c, c->normal, c->angular_normal1, c->angular_normal2, c->normal_impulse);
+        apply_constraint_impulse(bodies, c, c->tangent1, c->angular_tangent1_1, c->angular_tangent1_2, c->tangent_impulse1);
+        apply_constraint_impulse(bodies, c, c->tangent2, c->angular_tangent2_1, c->angular_tangent2_2, c->tangent_impulse2);
+    }
+}
+
+/*
+ * One sequential impulse pass. Impulses are clamped on their totals for the step, so a
+ * later pass can take back part of what an earlier one applied. When substepping,
+ * inv_substep_dt is one over the substep and contacts that have opened up since the step
+ * started let the bodies approach until the gap closes. Otherwise it is zero.
+ */
+void ContactSolver::solve_range(int begin, int end, float inv_substep_dt) {
+    for (int i = begin; i < end; i++) {
+        ContactConstraint *c = &constraints[i];
+        float target_velocity = c->step_bias;
+
+        if (inv_substep_dt > 0.0) {
+            float separation = get_separation(bodies, c);
+            target_velocity = c->bias;
+
+            if (separation > 0.0) {
+                target_velocity = -separation * inv_substep_dt;
+            }
+        }
+
+        float vn = get_relative_velocity(bodies, c, c->normal, c->rn1, c->rn2);
+        float lambda = c->normal_mass * (target_velocity - vn);
+        float old_impulse = c->normal_impulse;
+        c->normal_impulse = MAX(old_impulse + lambda, 0.0);
+        apply_constraint_impulse(bodies, c, c->normal, c->angular_normal1, c->angular_normal2, c->normal_impulse - old_impulse);
+
+        float max_friction = c->friction * c->normal_impulse;
+
+        float vt1 = get_relative_velocity(bodies, c, c->tangent1, c->rt1_1, c->rt1_2);
+        lambda = -c->tangent_mass1 * vt1;
+        old_impulse = c->tangent_impulse1;
+        c->tangent_impulse1 = MAX(-max_friction, MIN(old_impulse + lambda, max_friction));
+        apply_constraint_impulse(bodies, c, c->tangent1, c->angular_tangent1_1, c->angular_tangent1_2, c->tangent_impulse1 - old_impulse);
+
+        float vt2 = get_relative_velocity(bodies, c, c->tangent2, c->rt2_1, c->rt2_2);
+        lambda = -c->tangent_mass2 * vt2;
+        old_impulse = c->tangent_impulse2;
+        c->tangent_impulse2 = MAX(-max_friction, MIN(old_impulse + lambda, max_friction));
+        apply_constraint_impulse(bodies, c, c->tangent2, c->angular_tangent2_1, c->angular_tangent2_2, c->tangent_impulse2 - old_impulse);
+    }
+}
+
+void ContactSolver::solve_island(int island_id, int iterations) {
+    int begin = island_first_constraint[island_id];
+    int end = begin + island_num_constraints[island_id];
+
+    for (int k = 0; k < iterations; k++) {
+        solve_range(begin, end, 0.0);
+    }
+}
+
+/*
+ * Cuts the step into num_substeps substeps. Each one takes in the forces, applies the
+ * impulses accumulated so far, makes a single pass over the constraints and moves the
+ * bodies, so one collision result serves every substep. The constraints keep the arms
+ * from the start of the step. init_island has already applied the warm start for the
+ * first substep.
+ */
+void ContactSolver::solve_island_substeps(int island_id, int num_substeps, float dt) {
+    Island *island = &island_builder->islands[island_id];
+    int *body_ids = &island_builder->body_ids[island->first_body];
+    int begin = island_first_constraint[island_id];
+    int end = begin + island_num_constraints[island_id];
+
+    float substep_dt = dt / num_substeps;
+    float damping = powf(VELOCITY_DAMPING, 1.0 / num_substeps);
+
+    for (int k = 0; k < num_substeps; k++) {
+        bodies->integrate_velocities(body_ids, island->num_bodies, substep_dt, damping);
+
+        if (k > 0) {
+            warm_start_range(begin, end);
+        }
+
+        solve_range(begin, end, 1.0 / substep_dt);
+        bodies->integrate_positions(body_ids, island->num_bodies, substep_dt);
+    }
+}
+
+/*
+ * Greedy coloring in constraint order. Each dynamic body keeps a mask of the colors its
+ * constraints already use. Constraints that find no free color among the 63 go into a
+ * last batch that is solved on one thread. The island's range is then sorted by color.
+ */
+void ContactSolver::color_island(int island_id) {
+    int begin = island_first_constraint[island_id];
+    int end = begin + island_num_constraints[island_id];
+    int overflow_color = 63;
+
+    int num_bodies = bodies->size();
+    body_colors = arena->allocate<unsigned long long>(num_bodies);
+    constraint_colors = arena->allocate<int>(end - begin);
+
+    for (int i = 0; i < num_bodies; i++) {
+        body_colors[i] = 0;
+    }
+
+    int num_colors = 0;
+    for (int i = begin; i < end; i++) {
+        ContactConstraint *c = &constraints[i];
+
+        unsigned long long used = 0;
+        if (!bodies->static_flags[c->body1_id]) {
+            used |= body_colors[c->body1_id];
+        }
+        if (!bodies->static_flags[c->body2_id]) {
+            used |= body_colors[c->body2_id];
+        }
+
+        int color = 0;
+        while (color < overflow_color && (used & (1ULL << color))) {
+            color++;
+        }
+
+        if (color < overflow_color) {
+            if (!bodies->static_flags[c->body1_id]) {
+                body_colors[c->body1_id] |= 1ULL << color;
+            }
+            if (!bodies->static_flags[c->body2_id]) {
+                body_colors[c->body2_id] |= 1ULL << color;
+            }
+        }
+
+        constraint_colors[i - begin] = color;
+        num_colors = MAX(num_colors, color + 1);
+    }
+
+    num_batches = num_colors;
+    batch_starts = arena->allocate<int>(num_colors + 1);
+    batch_next = arena->allocate<int>(num_colors + 1);
+
+    for (int i = 0; i < num_colors + 1; i++) {
+        batch_starts[i] = 0;
+    }
+    for (int i = 0; i < end - begin; i++) {
+        batch_starts[constraint_colors[i] + 1]++;
+    }
+    for (int i = 0; i < num_colors; i++) {
+        batch_starts[i + 1] += batch_starts[i];
+    }
+
+    sorted_constraints = arena->allocate<ContactConstraint>(end - begin);
+    for (int i = 0; i < num_colors + 1; i++) {
+        batch_next[i] = batch_starts[i];
+    }
+    for (int i = 0; i < end - begin; i++) {
+        sorted_constraints[batch_next[constraint_colors[i]]++] = constraints[begin + i];
+    }
+
+    for (int i = 0; i < end - begin; i++) {
+        constraints[begin + i] = sorted_constraints[i];
+    }
+
+    for (int i = 0; i < num_colors + 1; i++) {
+        batch_starts[i] += begin;
+    }
+}
+
+struct BatchJob {
+    ContactSolver *solver;
+    int batch_start;
+    float inv_substep_dt;
+};
+
+void ContactSolver::solve_batch_task(void *data, int begin, int end) {
+    BatchJob *job = (BatchJob*) data;
+    job->solver->solve_range(job->batch_start + begin, job->batch_start + end, job->inv_substep_dt);
+}
+
+/*
+ * One pass over a colored island, one color at a time, with the constraints of a color
+ * spread over the thread pool.
+ */
+void ContactSolver::solve_batches(float inv_substep_dt, ThreadPool *thread_pool) {
+    int overflow_color = 63;
+
+    for (int i = 0; i < num_batches; i++) {
+        int batch_begin = batch_starts[i];
+        int batch_end = batch_starts[i + 1];
+
+        if (i == overflow_color) {
+            solve_range(batch_begin, batch_end, inv_substep_dt);
+            continue;
+        }
+
+        BatchJob job;
+        job.solver = this;
+        job.batch_start = batch_begin;
+        job.inv_substep_dt = inv_substep_dt;
+        thread_pool->parallel_for(batch_end - batch_begin, batch_grain_size, solve_batch_task, &job);
+    }
+}
+
+void ContactSolver::solve_split_island(int island_id, int iterations, ThreadPool *thread_pool) {
+    color_island(island_id);
+
+    for (int k = 0; k < iterations; k++) {
+        solve_batches(0.0, thread_pool);
+    }
+}
+
+/*
+ * solve_island_substeps for a split island. The bodies are integrated on the calling
+ * thread, only the constraint passes are spread over the pool.
+ */
+void ContactSolver::solve_split_island_substeps(int island_id, int num_substeps, float dt, ThreadPool *thread_pool) {
+    color_island(island_id);
+
+    Island *island = &island_builder->islands[island_id];
+    int *body_ids = &island_builder->body_ids[island->first_body];
+    int begin = island_first_constraint[island_id];
+    int end = begin + island_num_constraints[island_id];
+
+    float substep_dt = dt / num_substeps;
+    float damping = powf(VELOCITY_DAMPING, 1.0 / num_substeps);
+
+    for (int k = 0; k < num_substeps; k++) {
+        bodies->integrate_velocities(body_ids, island->num_bodies, substep_dt, damping);
+
+        if (k > 0) {
+            warm_start_range(begin, end);
+        }
+
+        solve_batches(1.0 / substep_dt, thread_pool);
+        bodies->integrate_positions(body_ids, island->num_bodies, substep_dt);
+    }
+}
+
+/*
+ * Writes the accumulated impulses back to the contacts so the contact cache can keep them.
+ */
+void ContactSolver::store_island_impulses(int island_id) {
+    int begin = island_first_constraint[island_id];
+    int end = begin + island_num_constraints[island_id];
+
+    for (int i = begin; i < end; i++) {
+        ContactConstraint *c = &constraints[i];
+        c->contact->normal_impulse = c->normal_impulse;
+        c->contact->tangent_impulse = c->tangent_impulse1 * c->tangent1 + c->tangent_impulse2 * c->tangent2;
+    }
+}
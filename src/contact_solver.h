@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "rigid_body.h"
+#include "collide_fine.h"
+#include "island.h"
+#include "frame_arena.h"
+#include "thread_pool.h"
+
+#define RESTITUTION_VELOCITY_THRESHOLD 1.0
+
+/*
+ * One contact point as the solver sees it. Everything that only depends on positions is
+ * computed once in the pre-step: the arms crossed with each direction, the velocity change
+ * those produce through the inverse inertia, and the effective masses. bias is the normal
+ * velocity the contact aims for once touching, and step_bias the one it aims for when the
+ * step is solved in one go. They only differ for speculative contacts, which may just
+ * close their gap over the step.
+ */
+struct ContactConstraint {
+    int body1_id, body2_id;
+    Contact *contact;
+
+    float inv_mass_1, inv_mass_2;
+    float friction;
+    float bias;
+    float step_bias;
+
+    vec3 normal, tangent1, tangent2;
+
+    vec3 rn1, rn2;
+    vec3 rt1_1, rt1_2;
+    vec3 rt2_1, rt2_2;
+
+    vec3 angular_normal1, angular_normal2;
+    vec3 angular_tangent1_1, angular_tangent1_2;
+    vec3 angular_tangent2_1, angular_tangent2_2;
+
+    float normal_mass;
+    float tangent_mass1, tangent_mass2;
+
+    float normal_impulse;
+    float tangent_impulse1, tangent_impulse2;
+};
+
+/*
+ * Islands do not share dynamic bodies, so each one can be solved on its own thread. An
+ * island with more than split_threshold constraints is split further by coloring its
+ * constraints so that no two of one color touch the same dynamic body, and then solving
+ * each color in parallel. Whether an island is split never depends on the thread count,
+ * so the results do not either. The constraints and colors are allocated from the step's
+ * arena.
+ */
+class ContactSolver {
+    private:
+        RigidBodyStore *bodies;
+        std::vector<ContactManifold> *manifolds;
+        IslandBuilder *island_builder;
+
+        FrameArena *arena;
+        float inv_dt;
+
+        ContactConstraint *constraints;
+        int *island_first_constraint;
+        int *island_num_constraints;
+
+        ContactConstraint *sorted_constraints;
+        unsigned long long *body_colors;
+        int *constraint_colors;
+        int *batch_starts;
+        int *batch_next;
+        int num_batches;
+
+        void warm_start_range(int begin, int end);
+        void solve_range(int begin, int end, float inv_substep_dt);
+        void color_island(int island_id);
+        void solve_batches(float inv_substep_dt, ThreadPool *thread_pool);
+
+        static void solve_batch_task(void *data, int begin, int end);
+
+    public:
+        int split_threshold;
+        int batch_grain_size;
+
+        ContactSolver();
+        void init(RigidBodyStore *bodies, std::vector<ContactManifold> *manifolds, IslandBuilder *island_builder, FrameArena *arena, float dt);
+        void init_island(int island_id, bool warm_start);
+        void solve_island(int island_id, int iterations);
+        void solve_split_island(int island_id, int iterations, ThreadPool *thread_pool);
+        void solve_island_substeps(int island_id, int num_substeps, float dt);
+        void solve_split_island_substeps(int island_id, int num_substeps, float dt, ThreadPool *thread_pool);
+        void store_island_impulses(int island_id);
+        bool is_split_island(int island_id);
+};
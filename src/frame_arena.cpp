@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "frame_arena.h"
+
+FrameArena::FrameArena() {
+    block = NULL;
+    block_size = 0;
+    used = 0;
+    overflow_used = 0;
+    high_water_mark = 0;
+}
+
+FrameArena::~FrameArena() {
+    reset();
+    free(block);
+}
+
+void FrameArena::reset() {
+    for (int i = 0; i < overflow_blocks.size(); i++) {
+        free(overflow_blocks[i]);
+    }
+    overflow_blocks.clear();
+
+    if (high_water_mark > block_size) {
+        free(block);
+        block_size = high_water_mark + high_water_mark / 4;
+        block = (char*) malloc(block_size);
+    }
+
+    used = 0;
+    overflow_used = 0;
+}
+
+/*
+ * alignment must be a power of two. Zero sized allocations still return a valid pointer.
+ */
+void *FrameArena::allocate(size_t size, size_t alignment) {
+    size_t begin = (used + alignment - 1) & ~(alignment - 1);
+    void *memory;
+
+    if (block && begin + size <= block_size) {
+        memory = block + begin;
+        used = begin + size;
+    }
+    else {
+        char *overflow_block = (char*) malloc(size + alignment);
+        overflow_blocks.push_back(overflow_block);
+        overflow_used += size + alignment;
+
+        size_t address = (size_t) overflow_block;
+        memory = (void*) ((address + alignment - 1) & ~(alignment - 1));
+    }
+
+    if (get_used() > high_water_mark) {
+        high_water_mark = get_used();
+    }
+
+    return memory;
+}
+
+/*
+ * Bytes handed out since the last reset, counting the padding for alignment.
+ */
+size_t FrameArena::get_used() {
+    return used + overflow_used;
+}
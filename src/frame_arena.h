@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Bump allocator for data that only lives for one step. allocate hands out consecutive
+ * slices of one block and reset takes them all back at once, so nothing is freed one
+ * piece at a time. A step that needs more than the block gets extra blocks from the heap,
+ * and the next reset grows the block to the most any step has used.
+ *
+ * Not thread safe, only allocate from the thread that runs the step. Tasks on the thread
+ * pool write into slices allocated for them up front.
+ */
+class FrameArena {
+    private:
+        char *block;
+        size_t block_size;
+        size_t used;
+        size_t overflow_used;
+        std::vector<char*> overflow_blocks;
+
+    public:
+        size_t high_water_mark;
+
+        FrameArena();
+        ~FrameArena();
+        void reset();
+        void *allocate(size_t size, size_t alignment);
+        size_t get_used();
+
+        template<typename T>
+        T *allocate(int count) {
+            return (T*) allocate(count * sizeof(T), alignof(T));
+        }
+};
@@ -0,0 +1,145 @@
+#include "island.h"
+
+IslandBuilder::IslandBuilder() {
+    parent = NULL;
+    body_islands = NULL;
+    counts = NULL;
+    islands = NULL;
+    num_islands = 0;
+    body_ids = NULL;
+    manifold_ids = NULL;
+}
+
+int IslandBuilder::find(int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+void IslandBuilder::join(int i, int j) {
+    int root_i = find(i);
+    int root_j = find(j);
+
+    if (root_i == root_j) {
+        return;
+    }
+
+    /*
+     * Keep the smaller id as the root so the islands come out in the same order every time.
+     */
+    if (root_i < root_j) {
+        parent[root_j] = root_i;
+    }
+    else {
+        parent[root_i] = root_j;
+    }
+}
+
+/*
+ * Islands are listed in order of their lowest body id, and the bodies and manifolds of an
+ * island keep their relative order, so the solver sees the same sequence every run.
+ */
+void IslandBuilder::build(const std::vector<Collider*> &colliders, const std::vector<ContactManifold> &manifolds, FrameArena *arena) {
+    int num_colliders = colliders.size();
+
+    parent = arena->allocate<int>(num_colliders);
+    body_islands = arena->allocate<int>(num_colliders);
+    for (int i = 0; i < num_colliders; i++) {
+        parent[i] = i;
+        body_islands[i] = -1;
+    }
+
+    for (int i = 0; i < manifolds.size(); i++) {
+        Collider *collider1 = manifolds[i].collider1;
+        Collider *collider2 = manifolds[i].collider2;
+
+        if (collider1->body.is_awake() && collider2->body.is_awake()) {
+            join(collider1->id, collider2->id);
+        }
+    }
+
+    /*
+     * Only awake bodies are joined, so every root is an awake body that is its own parent.
+     */
+    num_islands = 0;
+    for (int i = 0; i < num_colliders; i++) {
+        if (colliders[i] && colliders[i]->body.is_awake() && find(i) == i) {
+            num_islands++;
+        }
+    }
+
+    islands = arena->allocate<Island>(num_islands);
+    num_islands = 0;
+
+    for (int i = 0; i < num_colliders; i++) {
+        if (colliders[i] == NULL || !colliders[i]->body.is_awake()) {
+            continue;
+        }
+
+        int root = find(i);
+        if (body_islands[root] == -1) {
+            Island island;
+            island.num_bodies = 0;
+            island.num_manifolds = 0;
+            body_islands[root] = num_islands;
+            islands[num_islands++] = island;
+        }
+
+        body_islands[i] = body_islands[root];
+        islands[body_islands[i]].num_bodies++;
+    }
+
+    for (int i = 0; i < manifolds.size(); i++) {
+        Collider *collider = manifolds[i].collider1;
+        if (!collider->body.is_awake()) {
+            collider = manifolds[i].collider2;
+        }
+
+        if (collider->body.is_awake()) {
+            islands[body_islands[collider->id]].num_manifolds++;
+        }
+    }
+
+    int num_bodies = 0;
+    int num_manifolds = 0;
+    for (int i = 0; i < num_islands; i++) {
+        islands[i].first_body = num_bodies;
+        islands[i].first_manifold = num_manifolds;
+        num_bodies += islands[i].num_bodies;
+        num_manifolds += islands[i].num_manifolds;
+    }
+
+    body_ids = arena->allocate<int>(num_bodies);
+    manifold_ids = arena->allocate<int>(num_manifolds);
+    counts = arena->allocate<int>(num_islands);
+
+    for (int i = 0; i < num_islands; i++) {
+        counts[i] = 0;
+    }
+
+    for (int i = 0; i < num_colliders; i++) {
+        int island_id = body_islands[i];
+        if (island_id != -1) {
+            body_ids[islands[island_id].first_body + counts[island_id]++] = i;
+        }
+    }
+
+    for (int i = 0; i < num_islands; i++) {
+        counts[i] = 0;
+    }
+
+    for (int i = 0; i < manifolds.size(); i++) {
+        Collider *collider = manifolds[i].collider1;
+        if (!collider->body.is_awake()) {
+            collider = manifolds[i].collider2;
+        }
+
+        if (collider->body.is_awake()) {
+            int island_id = body_islands[collider->id];
+            manifold_ids[islands[island_id].first_manifold + counts[island_id]++] = i;
+        }
+    }
+}
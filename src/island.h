@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "collide_fine.h"
+#include "frame_arena.h"
+
+struct Island {
+    int first_body;
+    int num_bodies;
+    int first_manifold;
+    int num_manifolds;
+};
+
+/*
+ * Groups the awake dynamic bodies into islands, the connected components of the contact
+ * graph. Static bodies do not join islands since they do not carry impulses between the
+ * bodies resting on them. Everything is allocated from the step's arena, so the islands
+ * are valid until the arena is next reset.
+ */
+class IslandBuilder {
+    private:
+        int *parent;
+        int *body_islands;
+        int *counts;
+
+        int find(int i);
+        void join(int i, int j);
+
+    public:
+        Island *islands;
+        int num_islands;
+        int *body_ids;
+        int *manifold_ids;
+
+        IslandBuilder();
+        void build(const std::vector<Collider*> &colliders, const std::vector<ContactManifold> &manifolds, FrameArena *arena);
+};
@@ -46,10 +46,10 @@ GLFWwindow *init_opengl(int width, int height, const char *title) {
     return window;
 }
 
-void init_jump_scene(PhysicsEngine *physics_engine) {
-    int instance_id, transform_id, collider_id;
+void init_jump_scene(Scene *scene, PhysicsEngine *physics_engine) {
+    int instance_id, transform_id;
+    ColliderHandle collider_handle;
     Collider *collider;
-    Scene *scene = physics_engine->scene;
 
     float restitution = 0.5;
     float friction = 0.2;
@@ -58,104 +58,105 @@ void init_jump_scene(PhysicsEngine *physics_engine) {
         instance_id = scene->add_instance(plane_mesh_ids[0]);
         scene->instances[instance_id].casts_shadow = false;
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_plane_collider(transform_id);
-        collider = physics_engine->colliders[collider_id];
+        collider_handle = physics_engine->add_plane_collider(transform_id);
+        collider = physics_engine->get_collider(collider_handle);
 
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = true;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(true);
     }
 
     {
         instance_id = scene->add_instance(cube_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_cube_collider(transform_id, vec3(1.0, 0.7, 1.0));
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(-4.0, 0.7, 0.0);
-        collider->body.orientation = quat(vec3(0.0, 1.0, 0.0), 0.75);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = true;
-        collider->body.inertia_tensor = RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 0.7, 1.0));
+        collider_handle = physics_engine->add_cube_collider(transform_id, vec3(1.0, 0.7, 1.0));
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(-4.0, 0.7, 0.0);
+        collider->body.orientation() = quat(vec3(0.0, 1.0, 0.0), 0.75);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(true);
+        collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 0.7, 1.0)));
     }
 
     {
         instance_id = scene->add_instance(cube_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_cube_collider(transform_id, vec3(1.0, 1.4, 1.0));
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(-1.0, 1.4, 0.0);
-        collider->body.orientation = quat(vec3(0.0, 1.0, 0.0), 0.55);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = true;
-        collider->body.inertia_tensor = RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 1.4, 1.0));
+        collider_handle = physics_engine->add_cube_collider(transform_id, vec3(1.0, 1.4, 1.0));
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(-1.0, 1.4, 0.0);
+        collider->body.orientation() = quat(vec3(0.0, 1.0, 0.0), 0.55);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(true);
+        collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 1.4, 1.0)));
     }
 
     {
         instance_id = scene->add_instance(cube_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_cube_collider(transform_id, vec3(1.0, 2.1, 1.0));
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(2.0, 2.1, -1.0);
-        collider->body.orientation = quat(vec3(0.0, 1.0, 0.0), 0.25);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = true;
-        collider->body.inertia_tensor = RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 2.1, 1.0));
+        collider_handle = physics_engine->add_cube_collider(transform_id, vec3(1.0, 2.1, 1.0));
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(2.0, 2.1, -1.0);
+        collider->body.orientation() = quat(vec3(0.0, 1.0, 0.0), 0.25);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(true);
+        collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 2.1, 1.0)));
     }
 
     {
         instance_id = scene->add_instance(cube_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_cube_collider(transform_id, vec3(1.0, 2.8, 1.0));
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(5.0, 2.8, -2.0);
-        collider->body.orientation = quat(vec3(0.0, 1.0, 0.0), 0.83);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = true;
-        collider->body.inertia_tensor = RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 2.8, 1.0));
+        collider_handle = physics_engine->add_cube_collider(transform_id, vec3(1.0, 2.8, 1.0));
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(5.0, 2.8, -2.0);
+        collider->body.orientation() = quat(vec3(0.0, 1.0, 0.0), 0.83);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(true);
+        collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(1.0, 2.8, 1.0)));
     }
 
     {
         /*
         instance_id = scene->add_instance(sphere_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_sphere_collider(transform_id, 0.2);
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(-7.0, 0.2, 0.2);
-        collider->body.orientation = quat(vec3(1.0, 0.0, 0.0), 0.0);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = false;
-        collider->body.inertia_tensor = RigidBody::create_sphere_inertia_tensor(1.0, 0.2);
+        collider_handle = physics_engine->add_sphere_collider(transform_id, 0.2);
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(-7.0, 0.2, 0.2);
+        collider->body.orientation() = quat(vec3(1.0, 0.0, 0.0), 0.0);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(false);
+        collider->body.set_inertia_tensor(RigidBody::create_sphere_inertia_tensor(1.0, 0.2));
         */
 
         instance_id = scene->add_instance(cube_mesh_ids[0]);
         transform_id = scene->instances[instance_id].transform_id;
-        collider_id = physics_engine->add_cube_collider(transform_id, vec3(0.2, 0.2, 0.2));
-        collider = physics_engine->colliders[collider_id];
-
-        collider->body.position = vec3(-7.0, 0.2, 0.2);
-        collider->body.orientation = quat(vec3(1.0, 0.0, 0.0), 0.0);
-        collider->body.mass = 1.0;
-        collider->body.restitution = restitution;
-        collider->body.friction = friction;
-        collider->body.is_static = false;
-        collider->body.inertia_tensor = RigidBody::create_box_inertia_tensor(1.0, vec3(0.2, 0.2, 0.2));
-
-        controlled_cube = physics_engine->colliders[collider_id];
+        collider_handle = physics_engine->add_cube_collider(transform_id, vec3(0.2, 0.2, 0.2));
+        collider = physics_engine->get_collider(collider_handle);
+
+        collider->body.position() = vec3(-7.0, 0.2, 0.2);
+        collider->body.orientation() = quat(vec3(1.0, 0.0, 0.0), 0.0);
+        collider->body.mass() = 1.0;
+        collider->body.restitution() = restitution;
+        collider->body.friction() = friction;
+        collider->body.set_static(false);
+        collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.2, 0.2, 0.2)));
+        collider->body.set_continuous(true);
+
+        controlled_cube = physics_engine->get_collider(collider_handle);
     }
 
 
@@ -186,13 +187,14 @@ int main() {
     renderer.shader = Shader::load_from_file("shaders/preamble.glsl", "shaders/default.frag", "shaders/default.vert");
 
     PhysicsEngine physics_engine;
-    physics_engine.scene = &scene;
+    physics_engine.transforms = &scene.transforms;
 
-    PhysicsSceneEditor physics_scene_editor(&physics_engine, &controls);
+    PhysicsSceneEditor physics_scene_editor(&scene, &physics_engine, &controls);
 
-    init_jump_scene(&physics_engine);
+    init_jump_scene(&scene, &physics_engine);
 
     float camera_azimuth = 0.0, camera_inclination = 0.6 * M_PI;
+    double last_frame_time = glfwGetTime();
 
     while (!glfwWindowShouldClose(window)) {
         glfwGetWindowSize(window, &window_width, &window_height);
@@ -224,40 +226,49 @@ int main() {
         camera_direction.y = cos(camera_inclination);
         camera_direction.z = sin(camera_inclination) * sin(camera_azimuth);
 
-        if (controls.key_down[GLFW_KEY_P] || controls.key_clicked[GLFW_KEY_O] || controlled_cube) {
-            physics_engine.update(0.016);
+        double frame_time = glfwGetTime();
+        float frame_dt = frame_time - last_frame_time;
+        last_frame_time = frame_time;
+
+        if (controls.key_down[GLFW_KEY_P] || controlled_cube) {
+            physics_engine.step_for(frame_dt);
+        }
+        else if (controls.key_clicked[GLFW_KEY_O]) {
+            physics_engine.update(physics_engine.fixed_dt);
         }
 
         if (controlled_cube) {
             if (controls.key_down[GLFW_KEY_Q]) {
-                controlled_cube->body.velocity.y += 0.7;
+                controlled_cube->body.wake();
+                controlled_cube->body.velocity().y += 0.7;
             }
 
             if (controls.key_down[GLFW_KEY_W] || controls.key_down[GLFW_KEY_A]
                     || controls.key_down[GLFW_KEY_S] || controls.key_down[GLFW_KEY_D]) {
-                controlled_cube->body.velocity.x = 0.0;
-                controlled_cube->body.velocity.z = 0.0;
+                controlled_cube->body.wake();
+                controlled_cube->body.velocity().x = 0.0;
+                controlled_cube->body.velocity().z = 0.0;
             }
 
             if (controls.key_down[GLFW_KEY_W]) {
-                controlled_cube->body.velocity.x += 2.0 * cosf(camera_azimuth);
-                controlled_cube->body.velocity.z += 2.0 * sinf(camera_azimuth);
+                controlled_cube->body.velocity().x += 2.0 * cosf(camera_azimuth);
+                controlled_cube->body.velocity().z += 2.0 * sinf(camera_azimuth);
             }
             if (controls.key_down[GLFW_KEY_A]) {
-                controlled_cube->body.velocity.x += 2.0 * cosf(camera_azimuth - 0.5 * M_PI);
-                controlled_cube->body.velocity.z += 2.0 * sinf(camera_azimuth - 0.5 * M_PI);
+                controlled_cube->body.velocity().x += 2.0 * cosf(camera_azimuth - 0.5 * M_PI);
+                controlled_cube->body.velocity().z += 2.0 * sinf(camera_azimuth - 0.5 * M_PI);
             }
             if (controls.key_down[GLFW_KEY_S]) {
-                controlled_cube->body.velocity.x += -2.0 * cosf(camera_azimuth);
-                controlled_cube->body.velocity.z += -2.0 * sinf(camera_azimuth);
+                controlled_cube->body.velocity().x += -2.0 * cosf(camera_azimuth);
+                controlled_cube->body.velocity().z += -2.0 * sinf(camera_azimuth);
             }
             if (controls.key_down[GLFW_KEY_D]) {
-                controlled_cube->body.velocity.x += -2.0 * cosf(camera_azimuth - 0.5 * M_PI);
-                controlled_cube->body.velocity.z += -2.0 * sinf(camera_azimuth - 0.5 * M_PI);
+                controlled_cube->body.velocity().x += -2.0 * cosf(camera_azimuth - 0.5 * M_PI);
+                controlled_cube->body.velocity().z += -2.0 * sinf(camera_azimuth - 0.5 * M_PI);
             }
 
-            scene.camera.eye = controlled_cube->body.position - 5.0 * camera_direction;
-            scene.camera.target = controlled_cube->body.position;
+            scene.camera.eye = controlled_cube->body.position() - 5.0 * camera_direction;
+            scene.camera.target = controlled_cube->body.position();
         }
         else {
             if (controls.key_down[GLFW_KEY_W]) {
@@ -1,3 +1,4 @@
+#include <float.h>
 #include <math.h>
 
 #include "maths.h"
@@ -10,69 +11,10 @@ float rand_num() {
  * 3-D vectors
  */
 
-vec3::vec3() {
-    this->x = 0.0;
-    this->y = 0.0;
-    this->z = 0.0;
-}
-
-vec3::vec3(float x, float y, float z) {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-}
-
-vec3::vec3(float v[3]) {
-    this->x = v[0];
-    this->y = v[1];
-    this->z = v[2];
-}
-
-vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.x + v.x, u.y + v.y, u.z + v.z);
-}
-
-vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.x - v.x, u.y - v.y, u.z - v.z);
-}
-
-vec3 operator*(float s , const vec3 &v) {
-    return vec3(s * v.x, s * v.y, s * v.z);
-}
-
-float vec3::dot(const vec3 &v1, const vec3 &v2) {
-    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
-}
-
-vec3 vec3::normalize() const {
-    float l = sqrt(this->x * this->x + this->y * this->y + this->z * this->z);
-
-    if (l == 0) {
-        return vec3(0, 0, 0);
-    }
-
-    return vec3(this->x / l, this->y / l, this->z / l);
-}
-
-vec3 vec3::cross(const vec3 &v1, const vec3 &v2) {
-    float x = v1.y * v2.z - v1.z * v2.y;
-    float y = v1.z * v2.x - v1.x * v2.z;
-    float z = v1.x * v2.y - v1.y * v2.x;
-    return vec3(x, y, z);
-}
-
 void vec3::print() const {
     printf("<%f, %f, %f>\n", this->x, this->y, this->z);
 }
 
-float vec3::length() const {
-    return sqrt(this->x * this->x + this->y * this->y + this->z * this->z);
-}
-
-float vec3::length_squared() const {
-    return this->x * this->x + this->y * this->y + this->z * this->z;
-}
-
 /*
  * 4-D vectors
  */
@@ -99,47 +41,6 @@ void vec4::print() {
  * 4 x 4 matrices
  */
 
-mat4::mat4() {
-    this->m[0] = 1.0;
-    this->m[1] = 0.0;
-    this->m[2] = 0.0;
-    this->m[3] = 0.0;
-    this->m[4] = 0.0;
-    this->m[5] = 1.0;
-    this->m[6] = 0.0;
-    this->m[7] = 0.0;
-    this->m[8] = 0.0;
-    this->m[9] = 0.0;
-    this->m[10] = 1.0;
-    this->m[11] = 0.0;
-    this->m[12] = 0.0;
-    this->m[13] = 0.0;
-    this->m[14] = 0.0;
-    this->m[15] = 1.0;
-}
-
-mat4::mat4(float a, float b, float c, float d,
-        float e, float f, float g, float h,
-        float i, float j, float k, float l,
-        float m, float n, float o, float p) {
-    this->m[0] = a;
-    this->m[1] = b;
-    this->m[2] = c;
-    this->m[3] = d;
-    this->m[4] = e;
-    this->m[5] = f;
-    this->m[6] = g;
-    this->m[7] = h;
-    this->m[8] = i;
-    this->m[9] = j;
-    this->m[10] = k;
-    this->m[11] = l;
-    this->m[12] = m;
-    this->m[13] = n;
-    this->m[14] = o;
-    this->m[15] = p;
-}
-
 mat4 mat4::identity() {
     return mat4(
             1.0, 0.0, 0.0, 0.0,
@@ -149,7 +50,6 @@ mat4 mat4::identity() {
             );
 }
 
-
 mat4 mat4::zero() {
     return mat4(
             0.0, 0.0, 0.0, 0.0,
@@ -221,16 +121,6 @@ void mat4::print() {
     printf("[%f, %f, %f, %f]\n", a[12], a[13], a[14], a[15]);
 }
 
-mat4 mat4::transpose() {
-    float *a = this->m;
-    return mat4(
-            a[0], a[4], a[8], a[12],
-            a[1], a[5], a[9], a[13],
-            a[2], a[6], a[10], a[14],
-            a[3], a[7], a[11], a[15]
-            );
-}
-
 mat4 mat4::normal_transform() {
     return this->inverse().transpose();
 }
@@ -388,86 +278,68 @@ mat4 mat4::orthographic_projection(float left, float right, float bottom, float
             );
 }
 
-mat4 operator*(const mat4 &m1, const mat4 &m2) {
-    const float *a = m1.m;
-    const float *b = m2.m;
-
-    float c0 = a[0]*b[0] + a[1]*b[4] + a[2]*b[8] + a[3]*b[12];
-    float c1 = a[0]*b[1] + a[1]*b[5] + a[2]*b[9] + a[3]*b[13];
-    float c2 = a[0]*b[2] + a[1]*b[6] + a[2]*b[10] + a[3]*b[14];
-    float c3 = a[0]*b[3] + a[1]*b[7] + a[2]*b[11] + a[3]*b[15];
-
-    float c4 = a[4]*b[0] + a[5]*b[4] + a[6]*b[8] + a[7]*b[12];
-    float c5 = a[4]*b[1] + a[5]*b[5] + a[6]*b[9] + a[7]*b[13];
-    float c6 = a[4]*b[2] + a[5]*b[6] + a[6]*b[10] + a[7]*b[14];
-    float c7 = a[4]*b[3] + a[5]*b[7] + a[6]*b[11] + a[7]*b[15];
-
-    float c8 = a[8]*b[0] + a[9]*b[4] + a[10]*b[8] + a[11]*b[12];
-    float c9 = a[8]*b[1] + a[9]*b[5] + a[10]*b[9] + a[11]*b[13];
-    float c10 = a[8]*b[2] + a[9]*b[6] + a[10]*b[10] + a[11]*b[14];
-    float c11 = a[8]*b[3] + a[9]*b[7] + a[10]*b[11] + a[11]*b[15];
-
-    float c12 = a[12]*b[0] + a[13]*b[4] + a[14]*b[8] + a[15]*b[12];
-    float c13 = a[12]*b[1] + a[13]*b[5] + a[14]*b[9] + a[15]*b[13];
-    float c14 = a[12]*b[2] + a[13]*b[6] + a[14]*b[10] + a[15]*b[14];
-    float c15 = a[12]*b[3] + a[13]*b[7] + a[14]*b[11] + a[15]*b[15];
+/*
+ * 3 x 3 matrices
+ */
 
-    return mat4(
-            c0, c1, c2, c3,
-            c4, c5, c6, c7,
-            c8, c9, c10, c11,
-            c12, c13, c14, c15
+mat3 mat3::identity() {
+    return mat3(
+            1.0, 0.0, 0.0,
+            0.0, 1.0, 0.0,
+            0.0, 0.0, 1.0
             );
 }
 
-vec3 operator*(const mat4 &m, const vec3 &v) {
-    float x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3];
-    float y = m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z + m.m[7];
-    float z = m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z + m.m[11];
-    return vec3(x, y, z);
+mat3 mat3::zero() {
+    return mat3(
+            0.0, 0.0, 0.0,
+            0.0, 0.0, 0.0,
+            0.0, 0.0, 0.0
+            );
 }
 
-vec4 operator*(const mat4 &m, const vec4 &v) {
-    float x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3] * v.w;
-    float y = m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z + m.m[7] * v.w;
-    float z = m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z + m.m[11] * v.w;
-    float w = m.m[12] * v.x + m.m[13] * v.y + m.m[14] * v.z + m.m[15] * v.w;
-    return vec4(x, y, z, w);
+void mat3::print() const {
+    const float *a = this->m;
+    printf("[%f, %f, %f]\n", a[0], a[1], a[2]);
+    printf("[%f, %f, %f]\n", a[3], a[4], a[5]);
+    printf("[%f, %f, %f]\n", a[6], a[7], a[8]);
 }
 
-float vec3::operator[](int i) const {
-    if (i == 0) {
-        return x;
-    }
-    else if (i == 1) {
-        return y;
-    }
-    return z;
+/*
+ * Transposed cofactors over the determinant.
+ */
+mat3 mat3::inverse() const {
+    const float *a = this->m;
+
+    float c0 = a[4]*a[8] - a[5]*a[7];
+    float c1 = a[5]*a[6] - a[3]*a[8];
+    float c2 = a[3]*a[7] - a[4]*a[6];
+    float det = a[0]*c0 + a[1]*c1 + a[2]*c2;
+
+    return mat3(
+            c0 / det, (a[2]*a[7] - a[1]*a[8]) / det, (a[1]*a[5] - a[2]*a[4]) / det,
+            c1 / det, (a[0]*a[8] - a[2]*a[6]) / det, (a[2]*a[3] - a[0]*a[5]) / det,
+            c2 / det, (a[1]*a[6] - a[0]*a[7]) / det, (a[0]*a[4] - a[1]*a[3]) / det
+            );
 }
 
-float& vec3::operator[](int i) {
-    if (i == 0) {
-        return x;
-    }
-    else if (i == 1) {
-        return y;
-    }
-    return z;
-}
+/*
+ * Rigid transforms
+ */
 
-quat::quat() {
-    this->x = 0;
-    this->y = 0;
-    this->z = 0;
-    this->w = 1;
+mat4 rigid_transform::get_matrix() const {
+    const float *r = rotation.m;
+    return mat4(
+            r[0], r[1], r[2], translation.x,
+            r[3], r[4], r[5], translation.y,
+            r[6], r[7], r[8], translation.z,
+            0.0, 0.0, 0.0, 1.0
+            );
 }
 
-quat::quat(float x, float y, float z, float w) {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-    this->w = w;
-}
+/*
+ * Quaternions
+ */
 
 quat::quat(const vec3 &v, float theta) {
     float temp = sin(theta / 2.0);
@@ -478,41 +350,10 @@ quat::quat(const vec3 &v, float theta) {
     *this = this->normalize();
 }
 
-quat quat::normalize() {
-    float mag = sqrt(this->w*this->w + this->x*this->x + this->y*this->y + this->z*this->z);
-
-    if (mag == 0) {
-        return *this;
-    }
-
-    return quat(this->x / mag, this->y / mag, this->z / mag, this->w / mag);
-}
-
-mat4 quat::get_matrix() {
-    float x = this->x;
-    float y = this->y;
-    float z = this->z;
-    float w = this->w;
-
-    return mat4(1.0 - 2.0 * y * y - 2.0 * z * z, 2.0 * x * y - 2.0 * w * z      , 2.0 * x * z + 2.0 * w * y      , 0.0,
-                2.0 * x * y + 2.0 * w * z      , 1.0 - 2.0 * x * x - 2.0 * z * z, 2.0 * y * z - 2.0 * w * x      , 0.0, 
-                2.0 * x * z - 2.0 * w * y      , 2.0 * y * z + 2.0 * w * x      , 1.0 - 2.0 * x * x - 2.0 * y * y, 0.0, 
-                0.0                            , 0.0                            , 0.0                            , 1.0);
-}
-
 void quat::print() {
     printf("<%f, %f, %f, %f>\n", this->x, this->y, this->z, this->z);
 }
 
-quat operator*(const quat &u, const quat &v) {
-    float x = v.w * u.x + v.x * u.w - v.y * u.z + v.z * u.y;
-    float y = v.w * u.y + v.x * u.z + v.y * u.w - v.z * u.x;
-    float z = v.w * u.z - v.x * u.y + v.y * u.x + v.z * u.w;
-    float w = v.w * u.w - v.x * u.x - v.y * u.y - v.z * u.z;
-
-    return quat(x, y, z, w).normalize();
-}
-
 vec3 ray::point_at_time(float t) {
     return origin + t * direction;
 }
@@ -550,6 +391,54 @@ bool ray::intersect_plane(const plane &p, float *t_out) {
     return true;
 }
 
+/*
+ * Slab test, the direction does not need to be normalized. Returns the entry time, or 0 if
+ * the origin is inside the box.
+ */
+bool ray::intersect_aabb(const aabb &box, float *t_out) {
+    float t0 = 0.0;
+    float t1 = FLT_MAX;
+
+    for (int i = 0; i < 3; i++) {
+        if (direction[i] == 0.0) {
+            if (origin[i] < box.min[i] || origin[i] > box.max[i]) {
+                return false;
+            }
+            continue;
+        }
+
+        float inv_d = 1.0 / direction[i];
+        float t_near = (box.min[i] - origin[i]) * inv_d;
+        float t_far = (box.max[i] - origin[i]) * inv_d;
+
+        if (t_near > t_far) {
+            float temp = t_near;
+            t_near = t_far;
+            t_far = temp;
+        }
+
+        t0 = MAX(t0, t_near);
+        t1 = MIN(t1, t_far);
+
+        if (t0 > t1) {
+            return false;
+        }
+    }
+
+    *t_out = t0;
+    return true;
+}
+
+ray_packet::ray_packet(const ray *rays, int num_rays, float max_t) {
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+        for (int i = 0; i < 3; i++) {
+            origin[i][lane] = lane < num_rays ? rays[lane].origin[i] : 0.0;
+            inv_direction[i][lane] = lane < num_rays ? 1.0 / rays[lane].direction[i] : 0.0;
+        }
+        this->max_t[lane] = lane < num_rays ? max_t : -1.0;
+    }
+}
+
 plane::plane() {
 }
 
@@ -558,6 +447,56 @@ plane::plane(const vec3 &p, const vec3 &n) {
     this->n = n;
 }
 
+aabb::aabb() {
+}
+
+aabb::aabb(const vec3 &min, const vec3 &max) {
+    this->min = min;
+    this->max = max;
+}
+
+bool aabb::overlaps(const aabb &other) const {
+    if (min.x > other.max.x || other.min.x > max.x) {
+        return false;
+    }
+
+    if (min.y > other.max.y || other.min.y > max.y) {
+        return false;
+    }
+
+    if (min.z > other.max.z || other.min.z > max.z) {
+        return false;
+    }
+
+    return true;
+}
+
+bool aabb::contains(const aabb &other) const {
+    return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z
+        && max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+}
+
+bool aabb::is_unbounded() const {
+    return min.x == -FLT_MAX || min.y == -FLT_MAX || min.z == -FLT_MAX
+        || max.x == FLT_MAX || max.y == FLT_MAX || max.z == FLT_MAX;
+}
+
+float aabb::surface_area() const {
+    vec3 d = max - min;
+    return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+aabb aabb::expand(float margin) const {
+    vec3 m = vec3(margin, margin, margin);
+    return aabb(min - m, max + m);
+}
+
+aabb aabb::merge(const aabb &a, const aabb &b) {
+    vec3 min = vec3(MIN(a.min.x, b.min.x), MIN(a.min.y, b.min.y), MIN(a.min.z, b.min.z));
+    vec3 max = vec3(MAX(a.max.x, b.max.x), MAX(a.max.y, b.max.y), MAX(a.max.z, b.max.z));
+    return aabb(min, max);
+}
+
 line_segment::line_segment() {
 }
 
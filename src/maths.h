@@ -1,10 +1,16 @@
 #pragma once
 
 #include <vector>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
+#if defined(__SSE__) && !defined(MATHS_NO_SIMD)
+#define MATHS_SSE
+#include <xmmintrin.h>
+#endif
+
 #define DEGREES_PER_RADIAN 0.01745329251
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -79,6 +85,30 @@ mat4 operator*(const mat4 &m1, const mat4 &m2);
 vec3 operator*(const mat4 &m, const vec3 &v);
 vec4 operator*(const mat4 &m, const vec4 &v);
 
+/*
+ * Row-major 3 x 3 matrix, for rotations and inertia tensors.
+ */
+struct mat3 {
+    float m[9];
+
+    mat3();
+    mat3(float a, float b, float c,
+            float d, float e, float f,
+            float g, float h, float i);
+
+    mat3 transpose() const;
+    mat3 inverse() const;
+    vec3 column(int i) const;
+    vec3 transpose_multiply(const vec3 &v) const;
+    void print() const;
+
+    static mat3 zero();
+    static mat3 identity();
+};
+
+mat3 operator*(const mat3 &m1, const mat3 &m2);
+vec3 operator*(const mat3 &m, const vec3 &v);
+
 struct quat {
     float x, y, z, w;
 
@@ -88,11 +118,34 @@ struct quat {
 
     quat normalize();
     mat4 get_matrix();
+    mat3 get_rotation();
     void print();
+
+    static quat nlerp(const quat &q1, const quat &q2, float t);
 };
 
 quat operator*(const quat &u, const quat &v);
 
+/*
+ * Rotation followed by a translation. The rotation is orthonormal, so the inverse is its
+ * transpose and never needs a general matrix inverse.
+ */
+struct rigid_transform {
+    mat3 rotation;
+    vec3 translation;
+
+    rigid_transform();
+    rigid_transform(const mat3 &rotation, const vec3 &translation);
+    rigid_transform(quat orientation, const vec3 &translation);
+
+    rigid_transform inverse() const;
+    vec3 transform_point(const vec3 &p) const;
+    vec3 transform_vector(const vec3 &v) const;
+    vec3 inverse_transform_point(const vec3 &p) const;
+    vec3 inverse_transform_vector(const vec3 &v) const;
+    mat4 get_matrix() const;
+};
+
 struct plane {
     vec3 p, n;
 
@@ -100,12 +153,15 @@ struct plane {
     plane(const vec3 &p, const vec3 &n);
 };
 
+struct aabb;
+
 struct ray {
     vec3 origin, direction; 
 
     vec3 point_at_time(float t);
     bool intersect_sphere(vec3 sphere_center, float sphere_radius, float *t_out);
     bool intersect_plane(const plane &p, float *t_out);
+    bool intersect_aabb(const aabb &box, float *t_out);
 };
 
 struct sphere {
@@ -113,6 +169,38 @@ struct sphere {
     float radius;
 };
 
+struct aabb {
+    vec3 min, max;
+
+    aabb();
+    aabb(const vec3 &min, const vec3 &max);
+
+    bool overlaps(const aabb &other) const;
+    bool contains(const aabb &other) const;
+    bool is_unbounded() const;
+    float surface_area() const;
+    aabb expand(float margin) const;
+
+    static aabb merge(const aabb &a, const aabb &b);
+};
+
+#define RAY_PACKET_SIZE 4
+
+/*
+ * Up to RAY_PACKET_SIZE rays laid out by axis, so a box can be slab tested against all of
+ * them at once. A ray only hits boxes it enters before its max_t, lanes without a ray have
+ * a negative max_t and never hit anything.
+ */
+struct ray_packet {
+    float origin[3][RAY_PACKET_SIZE];
+    float inv_direction[3][RAY_PACKET_SIZE];
+    float max_t[RAY_PACKET_SIZE];
+
+    ray_packet(const ray *rays, int num_rays, float max_t);
+
+    int intersect_aabb(const aabb &box) const;
+};
+
 struct line_segment {
     vec3 p0, p1;
 
@@ -121,3 +209,500 @@ struct line_segment {
 
     bool intersect_plane(const plane &p, vec3 *point);  
 };
+
+/*
+ * The operators below are called from the solver, the narrowphase and the renderer many
+ * times a frame, so they are defined here where they can be inlined. Cross products, mat4
+ * products and transposes and ray packet slab tests use SSE when the compiler targets it,
+ * define MATHS_NO_SIMD to force the scalar versions. Both do the same operations in the
+ * same order, so they give the same results.
+ */
+
+inline vec3::vec3() {
+    this->x = 0.0;
+    this->y = 0.0;
+    this->z = 0.0;
+}
+
+inline vec3::vec3(float x, float y, float z) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+}
+
+inline vec3::vec3(float v[3]) {
+    this->x = v[0];
+    this->y = v[1];
+    this->z = v[2];
+}
+
+inline vec3 operator+(const vec3 &u, const vec3 &v) {
+    return vec3(u.x + v.x, u.y + v.y, u.z + v.z);
+}
+
+inline vec3 operator-(const vec3 &u, const vec3 &v) {
+    return vec3(u.x - v.x, u.y - v.y, u.z - v.z);
+}
+
+inline vec3 operator*(float s , const vec3 &v) {
+    return vec3(s * v.x, s * v.y, s * v.z);
+}
+
+inline float vec3::dot(const vec3 &v1, const vec3 &v2) {
+    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+}
+
+inline float vec3::length() const {
+    return sqrt(this->x * this->x + this->y * this->y + this->z * this->z);
+}
+
+inline float vec3::length_squared() const {
+    return this->x * this->x + this->y * this->y + this->z * this->z;
+}
+
+inline vec3 vec3::normalize() const {
+    float l = sqrt(this->x * this->x + this->y * this->y + this->z * this->z);
+
+    if (l == 0) {
+        return vec3(0, 0, 0);
+    }
+
+    return vec3(this->x / l, this->y / l, this->z / l);
+}
+
+inline float vec3::operator[](int i) const {
+    if (i == 0) {
+        return x;
+    }
+    else if (i == 1) {
+        return y;
+    }
+    return z;
+}
+
+inline float& vec3::operator[](int i) {
+    if (i == 0) {
+        return x;
+    }
+    else if (i == 1) {
+        return y;
+    }
+    return z;
+}
+
+inline mat4::mat4() {
+    this->m[0] = 1.0;
+    this->m[1] = 0.0;
+    this->m[2] = 0.0;
+    this->m[3] = 0.0;
+    this->m[4] = 0.0;
+    this->m[5] = 1.0;
+    this->m[6] = 0.0;
+    this->m[7] = 0.0;
+    this->m[8] = 0.0;
+    this->m[9] = 0.0;
+    this->m[10] = 1.0;
+    this->m[11] = 0.0;
+    this->m[12] = 0.0;
+    this->m[13] = 0.0;
+    this->m[14] = 0.0;
+    this->m[15] = 1.0;
+}
+
+inline mat4::mat4(float a, float b, float c, float d,
+        float e, float f, float g, float h,
+        float i, float j, float k, float l,
+        float m, float n, float o, float p) {
+    this->m[0] = a;
+    this->m[1] = b;
+    this->m[2] = c;
+    this->m[3] = d;
+    this->m[4] = e;
+    this->m[5] = f;
+    this->m[6] = g;
+    this->m[7] = h;
+    this->m[8] = i;
+    this->m[9] = j;
+    this->m[10] = k;
+    this->m[11] = l;
+    this->m[12] = m;
+    this->m[13] = n;
+    this->m[14] = o;
+    this->m[15] = p;
+}
+
+/*
+ * Scalar versions of the operators that also have an SSE version. They are defined either
+ * way, so the two can be checked against each other.
+ */
+
+inline vec3 cross_scalar(const vec3 &v1, const vec3 &v2) {
+    float x = v1.y * v2.z - v1.z * v2.y;
+    float y = v1.z * v2.x - v1.x * v2.z;
+    float z = v1.x * v2.y - v1.y * v2.x;
+    return vec3(x, y, z);
+}
+
+inline mat4 transpose_scalar(const mat4 &m) {
+    const float *a = m.m;
+    return mat4(
+            a[0], a[4], a[8], a[12],
+            a[1], a[5], a[9], a[13],
+            a[2], a[6], a[10], a[14],
+            a[3], a[7], a[11], a[15]
+            );
+}
+
+inline mat4 multiply_scalar(const mat4 &m1, const mat4 &m2) {
+    const float *a = m1.m;
+    const float *b = m2.m;
+
+    float c0 = a[0]*b[0] + a[1]*b[4] + a[2]*b[8] + a[3]*b[12];
+    float c1 = a[0]*b[1] + a[1]*b[5] + a[2]*b[9] + a[3]*b[13];
+    float c2 = a[0]*b[2] + a[1]*b[6] + a[2]*b[10] + a[3]*b[14];
+    float c3 = a[0]*b[3] + a[1]*b[7] + a[2]*b[11] + a[3]*b[15];
+
+    float c4 = a[4]*b[0] + a[5]*b[4] + a[6]*b[8] + a[7]*b[12];
+    float c5 = a[4]*b[1] + a[5]*b[5] + a[6]*b[9] + a[7]*b[13];
+    float c6 = a[4]*b[2] + a[5]*b[6] + a[6]*b[10] + a[7]*b[14];
+    float c7 = a[4]*b[3] + a[5]*b[7] + a[6]*b[11] + a[7]*b[15];
+
+    float c8 = a[8]*b[0] + a[9]*b[4] + a[10]*b[8] + a[11]*b[12];
+    float c9 = a[8]*b[1] + a[9]*b[5] + a[10]*b[9] + a[11]*b[13];
+    float c10 = a[8]*b[2] + a[9]*b[6] + a[10]*b[10] + a[11]*b[14];
+    float c11 = a[8]*b[3] + a[9]*b[7] + a[10]*b[11] + a[11]*b[15];
+
+    float c12 = a[12]*b[0] + a[13]*b[4] + a[14]*b[8] + a[15]*b[12];
+    float c13 = a[12]*b[1] + a[13]*b[5] + a[14]*b[9] + a[15]*b[13];
+    float c14 = a[12]*b[2] + a[13]*b[6] + a[14]*b[10] + a[15]*b[14];
+    float c15 = a[12]*b[3] + a[13]*b[7] + a[14]*b[11] + a[15]*b[15];
+
+    return mat4(
+            c0, c1, c2, c3,
+            c4, c5, c6, c7,
+            c8, c9, c10, c11,
+            c12, c13, c14, c15
+            );
+}
+
+/*
+ * MIN and MAX pick their second argument when either is NaN, like the SSE instructions do.
+ */
+inline int intersect_aabb_scalar(const ray_packet &packet, const aabb &box) {
+    int mask = 0;
+
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+        float t0 = 0.0;
+        float t1 = packet.max_t[lane];
+
+        for (int i = 0; i < 3; i++) {
+            float t_min = (box.min[i] - packet.origin[i][lane]) * packet.inv_direction[i][lane];
+            float t_max = (box.max[i] - packet.origin[i][lane]) * packet.inv_direction[i][lane];
+            t0 = MAX(t0, MIN(t_min, t_max));
+            t1 = MIN(t1, MAX(t_min, t_max));
+        }
+
+        if (t0 <= t1) {
+            mask |= 1 << lane;
+        }
+    }
+
+    return mask;
+}
+
+#ifdef MATHS_SSE
+
+/*
+ * The three products of each component are lined up as the yzx and zxy rotations of both
+ * vectors, the unused fourth lane is zero.
+ */
+inline vec3 cross_sse(const vec3 &v1, const vec3 &v2) {
+    __m128 a = _mm_setr_ps(v1.x, v1.y, v1.z, 0.0);
+    __m128 b = _mm_setr_ps(v2.x, v2.y, v2.z, 0.0);
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+
+    float c[4];
+    _mm_storeu_ps(c, _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+    return vec3(c[0], c[1], c[2]);
+}
+
+inline mat4 transpose_sse(const mat4 &m) {
+    __m128 row0 = _mm_loadu_ps(&m.m[0]);
+    __m128 row1 = _mm_loadu_ps(&m.m[4]);
+    __m128 row2 = _mm_loadu_ps(&m.m[8]);
+    __m128 row3 = _mm_loadu_ps(&m.m[12]);
+    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+
+    mat4 result;
+    _mm_storeu_ps(&result.m[0], row0);
+    _mm_storeu_ps(&result.m[4], row1);
+    _mm_storeu_ps(&result.m[8], row2);
+    _mm_storeu_ps(&result.m[12], row3);
+    return result;
+}
+
+/*
+ * Row i of the product is the rows of m2 weighted by the elements of row i of m1.
+ */
+inline mat4 multiply_sse(const mat4 &m1, const mat4 &m2) {
+    const float *a = m1.m;
+
+    __m128 b0 = _mm_loadu_ps(&m2.m[0]);
+    __m128 b1 = _mm_loadu_ps(&m2.m[4]);
+    __m128 b2 = _mm_loadu_ps(&m2.m[8]);
+    __m128 b3 = _mm_loadu_ps(&m2.m[12]);
+
+    mat4 result;
+    for (int i = 0; i < 16; i += 4) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a[i]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i + 1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i + 2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i + 3]), b3));
+        _mm_storeu_ps(&result.m[i], row);
+    }
+
+    return result;
+}
+
+/*
+ * Returns a mask with bit i set when lane i hits the box. A zero direction component gives
+ * an infinite inverse, so a ray parallel to a face that lies exactly in its plane can be
+ * reported as a miss.
+ */
+inline int intersect_aabb_sse(const ray_packet &packet, const aabb &box) {
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_loadu_ps(packet.max_t);
+
+    for (int i = 0; i < 3; i++) {
+        __m128 o = _mm_loadu_ps(packet.origin[i]);
+        __m128 inv_d = _mm_loadu_ps(packet.inv_direction[i]);
+        __m128 t_min = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.min[i]), o), inv_d);
+        __m128 t_max = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max[i]), o), inv_d);
+        t0 = _mm_max_ps(t0, _mm_min_ps(t_min, t_max));
+        t1 = _mm_min_ps(t1, _mm_max_ps(t_min, t_max));
+    }
+
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+#endif
+
+inline vec3 vec3::cross(const vec3 &v1, const vec3 &v2) {
+#ifdef MATHS_SSE
+    return cross_sse(v1, v2);
+#else
+    return cross_scalar(v1, v2);
+#endif
+}
+
+inline mat4 mat4::transpose() {
+#ifdef MATHS_SSE
+    return transpose_sse(*this);
+#else
+    return transpose_scalar(*this);
+#endif
+}
+
+inline mat4 operator*(const mat4 &m1, const mat4 &m2) {
+#ifdef MATHS_SSE
+    return multiply_sse(m1, m2);
+#else
+    return multiply_scalar(m1, m2);
+#endif
+}
+
+inline int ray_packet::intersect_aabb(const aabb &box) const {
+#ifdef MATHS_SSE
+    return intersect_aabb_sse(*this, box);
+#else
+    return intersect_aabb_scalar(*this, box);
+#endif
+}
+
+inline vec3 operator*(const mat4 &m, const vec3 &v) {
+    float x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3];
+    float y = m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z + m.m[7];
+    float z = m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z + m.m[11];
+    return vec3(x, y, z);
+}
+
+inline vec4 operator*(const mat4 &m, const vec4 &v) {
+    float x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z + m.m[3] * v.w;
+    float y = m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z + m.m[7] * v.w;
+    float z = m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z + m.m[11] * v.w;
+    float w = m.m[12] * v.x + m.m[13] * v.y + m.m[14] * v.z + m.m[15] * v.w;
+    return vec4(x, y, z, w);
+}
+
+inline quat::quat() {
+    this->x = 0;
+    this->y = 0;
+    this->z = 0;
+    this->w = 1;
+}
+
+inline quat::quat(float x, float y, float z, float w) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+    this->w = w;
+}
+
+inline quat quat::normalize() {
+    float mag = sqrt(this->w*this->w + this->x*this->x + this->y*this->y + this->z*this->z);
+
+    if (mag == 0) {
+        return *this;
+    }
+
+    return quat(this->x / mag, this->y / mag, this->z / mag, this->w / mag);
+}
+
+/*
+ * Normalized linear blend from q1 to q2 along the shorter arc. Close enough to slerp for
+ * the small rotations between two steps.
+ */
+inline quat quat::nlerp(const quat &q1, const quat &q2, float t) {
+    float dot = q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w;
+    float s = dot < 0.0 ? -t : t;
+
+    return quat((1.0 - t) * q1.x + s * q2.x, (1.0 - t) * q1.y + s * q2.y,
+            (1.0 - t) * q1.z + s * q2.z, (1.0 - t) * q1.w + s * q2.w).normalize();
+}
+
+inline mat4 quat::get_matrix() {
+    float x = this->x;
+    float y = this->y;
+    float z = this->z;
+    float w = this->w;
+
+    return mat4(1.0 - 2.0 * y * y - 2.0 * z * z, 2.0 * x * y - 2.0 * w * z      , 2.0 * x * z + 2.0 * w * y      , 0.0,
+                2.0 * x * y + 2.0 * w * z      , 1.0 - 2.0 * x * x - 2.0 * z * z, 2.0 * y * z - 2.0 * w * x      , 0.0, 
+                2.0 * x * z - 2.0 * w * y      , 2.0 * y * z + 2.0 * w * x      , 1.0 - 2.0 * x * x - 2.0 * y * y, 0.0, 
+                0.0                            , 0.0                            , 0.0                            , 1.0);
+}
+
+inline quat operator*(const quat &u, const quat &v) {
+    float x = v.w * u.x + v.x * u.w - v.y * u.z + v.z * u.y;
+    float y = v.w * u.y + v.x * u.z + v.y * u.w - v.z * u.x;
+    float z = v.w * u.z - v.x * u.y + v.y * u.x + v.z * u.w;
+    float w = v.w * u.w - v.x * u.x - v.y * u.y - v.z * u.z;
+
+    return quat(x, y, z, w).normalize();
+}
+
+inline mat3::mat3() {
+    this->m[0] = 1.0;
+    this->m[1] = 0.0;
+    this->m[2] = 0.0;
+    this->m[3] = 0.0;
+    this->m[4] = 1.0;
+    this->m[5] = 0.0;
+    this->m[6] = 0.0;
+    this->m[7] = 0.0;
+    this->m[8] = 1.0;
+}
+
+inline mat3::mat3(float a, float b, float c,
+        float d, float e, float f,
+        float g, float h, float i) {
+    this->m[0] = a;
+    this->m[1] = b;
+    this->m[2] = c;
+    this->m[3] = d;
+    this->m[4] = e;
+    this->m[5] = f;
+    this->m[6] = g;
+    this->m[7] = h;
+    this->m[8] = i;
+}
+
+inline mat3 mat3::transpose() const {
+    const float *a = this->m;
+    return mat3(
+            a[0], a[3], a[6],
+            a[1], a[4], a[7],
+            a[2], a[5], a[8]
+            );
+}
+
+inline vec3 mat3::column(int i) const {
+    return vec3(m[i], m[i + 3], m[i + 6]);
+}
+
+/*
+ * transpose() * v without building the transpose.
+ */
+inline vec3 mat3::transpose_multiply(const vec3 &v) const {
+    float x = m[0] * v.x + m[3] * v.y + m[6] * v.z;
+    float y = m[1] * v.x + m[4] * v.y + m[7] * v.z;
+    float z = m[2] * v.x + m[5] * v.y + m[8] * v.z;
+    return vec3(x, y, z);
+}
+
+inline mat3 operator*(const mat3 &m1, const mat3 &m2) {
+    const float *a = m1.m;
+    const float *b = m2.m;
+
+    return mat3(
+            a[0]*b[0] + a[1]*b[3] + a[2]*b[6], a[0]*b[1] + a[1]*b[4] + a[2]*b[7], a[0]*b[2] + a[1]*b[5] + a[2]*b[8],
+            a[3]*b[0] + a[4]*b[3] + a[5]*b[6], a[3]*b[1] + a[4]*b[4] + a[5]*b[7], a[3]*b[2] + a[4]*b[5] + a[5]*b[8],
+            a[6]*b[0] + a[7]*b[3] + a[8]*b[6], a[6]*b[1] + a[7]*b[4] + a[8]*b[7], a[6]*b[2] + a[7]*b[5] + a[8]*b[8]
+            );
+}
+
+inline vec3 operator*(const mat3 &m, const vec3 &v) {
+    float x = m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z;
+    float y = m.m[3] * v.x + m.m[4] * v.y + m.m[5] * v.z;
+    float z = m.m[6] * v.x + m.m[7] * v.y + m.m[8] * v.z;
+    return vec3(x, y, z);
+}
+
+inline mat3 quat::get_rotation() {
+    float x = this->x;
+    float y = this->y;
+    float z = this->z;
+    float w = this->w;
+
+    return mat3(1.0 - 2.0 * y * y - 2.0 * z * z, 2.0 * x * y - 2.0 * w * z      , 2.0 * x * z + 2.0 * w * y      ,
+                2.0 * x * y + 2.0 * w * z      , 1.0 - 2.0 * x * x - 2.0 * z * z, 2.0 * y * z - 2.0 * w * x      ,
+                2.0 * x * z - 2.0 * w * y      , 2.0 * y * z + 2.0 * w * x      , 1.0 - 2.0 * x * x - 2.0 * y * y);
+}
+
+inline rigid_transform::rigid_transform() {
+    translation = vec3(0.0, 0.0, 0.0);
+}
+
+inline rigid_transform::rigid_transform(const mat3 &rotation, const vec3 &translation) {
+    this->rotation = rotation;
+    this->translation = translation;
+}
+
+inline rigid_transform::rigid_transform(quat orientation, const vec3 &translation) {
+    this->rotation = orientation.get_rotation();
+    this->translation = translation;
+}
+
+inline rigid_transform rigid_transform::inverse() const {
+    mat3 inv_rotation = rotation.transpose();
+    return rigid_transform(inv_rotation, -1.0 * (inv_rotation * translation));
+}
+
+inline vec3 rigid_transform::transform_point(const vec3 &p) const {
+    return rotation * p + translation;
+}
+
+inline vec3 rigid_transform::transform_vector(const vec3 &v) const {
+    return rotation * v;
+}
+
+inline vec3 rigid_transform::inverse_transform_point(const vec3 &p) const {
+    return rotation.transpose_multiply(p - translation);
+}
+
+inline vec3 rigid_transform::inverse_transform_vector(const vec3 &v) const {
+    return rotation.transpose_multiply(v);
+}
@@ -1,190 +1,1305 @@
+#include <algorithm>
+
 #include "physics_engine.h"
 
-int PhysicsEngine::add_cube_collider(int transform_id, const vec3 &half_lengths) {
-    BoxCollider *collider = new BoxCollider();
-    collider->id = colliders.size();
+PhysicsStats::PhysicsStats() {
+    num_colliders = 0;
+    num_possible_pairs = 0;
+    num_broadphase_pairs = 0;
+    num_contact_manifolds = 0;
+    num_warm_started_contacts = 0;
+    num_islands = 0;
+    num_awake_bodies = 0;
+    num_sleeping_bodies = 0;
+    arena_high_water_mark = 0;
+    num_continuous_impacts = 0;
+    num_collider_slots = 0;
+    num_pooled_colliders = 0;
+    num_broadphase_nodes = 0;
+}
+
+ColliderHandle::ColliderHandle() {
+    id = -1;
+    generation = 0;
+}
+
+ColliderHandle::ColliderHandle(int id, int generation) {
+    this->id = id;
+    this->generation = generation;
+}
+
+PhysicsEngine::PhysicsEngine() {
+    broadphase = new DynamicAABBTree();
+    bucket_pair_ids = NULL;
+    continuous_body_ids = NULL;
+    continuous_start_positions = NULL;
+    continuous_start_orientations = NULL;
+    num_continuous_bodies = 0;
+    transforms = NULL;
+    num_colliders = 0;
+    velocity_iterations = 10;
+    substeps = 1;
+    narrowphase_grain_size = 64;
+    warm_starting = true;
+    speculative_contacts = false;
+    allow_sleeping = true;
+    sleep_linear_velocity = 0.05;
+    sleep_angular_velocity = 0.1;
+    time_to_sleep = 0.5;
+    fixed_dt = 1.0 / 60.0;
+    max_substeps = 4;
+    interpolation_alpha = 1.0;
+    accumulator = 0.0;
+}
+
+/*
+ * Takes ownership of new_broadphase and moves every existing collider into it.
+ */
+void PhysicsEngine::set_broadphase(Broadphase *new_broadphase) {
+    delete broadphase;
+    broadphase = new_broadphase;
+
+    for (int i = 0; i < colliders.size(); i++) {
+        if (colliders[i]) {
+            broadphase->add_collider(colliders[i]->id);
+        }
+    }
+}
+
+/*
+ * Islands are spread over num_threads threads, counting the one that calls update. The
+ * results are the same for any number of threads.
+ */
+void PhysicsEngine::set_num_threads(int num_threads) {
+    thread_pool.set_num_threads(num_threads);
+}
+
+int PhysicsEngine::get_num_threads() {
+    return thread_pool.get_num_threads();
+}
+
+/*
+ * Ids of removed colliders are reused before colliders grows, along with the body of the
+ * same id, so colliders and bodies stay as large as the most colliders alive at once.
+ */
+ColliderHandle PhysicsEngine::add_collider(Collider *collider, int transform_id) {
+    if (free_collider_ids.size() > 0) {
+        collider->id = free_collider_ids.back();
+        free_collider_ids.pop_back();
+        bodies.reset_body(collider->id);
+        colliders[collider->id] = collider;
+        sleep_links[collider->id] = -1;
+    }
+    else {
+        collider->id = colliders.size();
+        bodies.create_body();
+        colliders.push_back(collider);
+        collider_generations.push_back(0);
+        sleep_links.push_back(-1);
+    }
+
     collider->transform_id = transform_id;
+    collider->body = RigidBody(&bodies, collider->id);
+    broadphase->add_collider(collider->id);
+    num_colliders++;
+    return ColliderHandle(collider->id, collider_generations[collider->id]);
+}
+
+ColliderHandle PhysicsEngine::add_cube_collider(int transform_id, const vec3 &half_lengths) {
+    BoxCollider *collider = box_colliders.allocate();
     collider->half_lengths = half_lengths;
-    colliders.push_back(collider);
-    return colliders.size() - 1;
+    return add_collider(collider, transform_id);
 }
 
-int PhysicsEngine::add_plane_collider(int transform_id) {
-    PlaneCollider *collider = new PlaneCollider();
-    collider->id = colliders.size();
-    collider->transform_id = transform_id;
-    colliders.push_back(collider);
-    return colliders.size() - 1;
+ColliderHandle PhysicsEngine::add_plane_collider(int transform_id) {
+    PlaneCollider *collider = plane_colliders.allocate();
+    return add_collider(collider, transform_id);
 }
 
-int PhysicsEngine::add_sphere_collider(int transform_id, float radius) {
-    SphereCollider *collider = new SphereCollider();
-    collider->id = colliders.size();
-    collider->transform_id = transform_id;
+ColliderHandle PhysicsEngine::add_sphere_collider(int transform_id, float radius) {
+    SphereCollider *collider = sphere_colliders.allocate();
     collider->radius = radius;
-    colliders.push_back(collider);
-    return colliders.size() - 1;
+    return add_collider(collider, transform_id);
 }
 
-std::vector<ContactManifold> PhysicsEngine::generate_contacts() {
-    std::vector<ContactManifold> manifolds;
+/*
+ * Returns NULL if the collider has been removed.
+ */
+Collider *PhysicsEngine::get_collider(ColliderHandle handle) {
+    if (handle.id < 0 || handle.id >= colliders.size() || collider_generations[handle.id] != handle.generation) {
+        return NULL;
+    }
 
-    for (int i = 0; i < colliders.size(); i++) {
-        Collider *collider1 = colliders[i];
-        for (int j = i + 1; j < colliders.size(); j++) {
-            Collider *collider2 = colliders[j];
-            ContactManifold manifold = collider1->collide(collider2);
-            if (manifold.contacts.size() > 0) {
-                manifolds.push_back(manifold);
+    return colliders[handle.id];
+}
+
+void PhysicsEngine::free_collider(Collider *collider) {
+    if (collider->shape == SHAPE_BOX) {
+        box_colliders.free((BoxCollider*) collider);
+    }
+    else if (collider->shape == SHAPE_SPHERE) {
+        sphere_colliders.free((SphereCollider*) collider);
+    }
+    else if (collider->shape == SHAPE_PLANE) {
+        plane_colliders.free((PlaneCollider*) collider);
+    }
+}
+
+/*
+ * Drops the pairs of a removed collider from the pair caches carried into the next step.
+ */
+void PhysicsEngine::forget_pair_caches(int collider_id) {
+    int num_kept = 0;
+
+    for (int i = 0; i < last_broadphase_pairs.size(); i++) {
+        BroadphasePair pair = last_broadphase_pairs[i];
+
+        if (pair.collider1_id != collider_id && pair.collider2_id != collider_id) {
+            last_broadphase_pairs[num_kept] = pair;
+            last_pair_caches[num_kept] = last_pair_caches[i];
+            num_kept++;
+        }
+    }
+
+    last_broadphase_pairs.resize(num_kept);
+    last_pair_caches.resize(num_kept);
+}
+
+/*
+ * Removes the collider and its body from the world. Sleeping bodies that were resting on
+ * it are woken so they do not hang in the air. They are found through the broadphase,
+ * which sleeping bodies never move out of date with, so removal costs no more in a large
+ * world than in a small one. Its slot in colliders is NULL until the id is reused, and
+ * handles to it stop resolving. The scene instance and transform belong to the caller
+ * and are left as they are. Must not be called during update.
+ */
+void PhysicsEngine::remove_collider(ColliderHandle handle) {
+    Collider *collider = get_collider(handle);
+    if (collider == NULL) {
+        return;
+    }
+
+    int id = collider->id;
+
+    if (sleep_links[id] != -1) {
+        wake_island(id);
+    }
+
+    aabb box = collider->get_aabb();
+    removal_candidates.clear();
+    broadphase->query_box(box, &removal_candidates);
+
+    for (int i = 0; i < removal_candidates.size(); i++) {
+        Collider *other = colliders[removal_candidates[i]];
+        if (other != collider && other->body.is_sleeping() && other->get_aabb().overlaps(box)) {
+            wake_island(other->id);
+        }
+    }
+
+    broadphase->remove_collider(id);
+    contact_cache.remove_collider(id);
+    forget_pair_caches(id);
+    bodies.free_body(id);
+
+    colliders[id] = NULL;
+    collider_generations[id]++;
+    free_collider_ids.push_back(id);
+    num_colliders--;
+    free_collider(collider);
+}
+
+/*
+ * Returns the closest collider hit by the ray, or a handle with id -1.
+ */
+ColliderHandle PhysicsEngine::raycast(ray r, float *t_out) {
+    RaycastHit hit;
+    raycast_batch(&r, 1, &hit);
+
+    if (hit.collider.id != -1) {
+        *t_out = hit.t;
+    }
+
+    return hit.collider;
+}
+
+/*
+ * Scratch space for the queries, kept from one query to the next so that they allocate
+ * nothing once it has grown. The broadphase lets several threads query at once, so each
+ * thread has its own rather than the engine owning one.
+ */
+struct QueryScratch {
+    std::vector<rigid_transform> box_transforms;
+    std::vector<int> candidates;
+    RigidBodyStore store;
+};
+
+static thread_local QueryScratch query_scratch;
+
+struct RaycastJob {
+    PhysicsEngine *engine;
+    const ray *rays;
+    RaycastHit *hits;
+    RaycastMode mode;
+    rigid_transform *box_transforms;
+};
+
+void PhysicsEngine::raycast_hit_callback(void *data, int ray_id, int collider_id, float *max_t) {
+    RaycastJob *job = (RaycastJob*) data;
+    PhysicsEngine *engine = job->engine;
+    Collider *collider = engine->colliders[collider_id];
+
+    float t;
+    bool is_hit;
+    if (collider->shape == SHAPE_BOX && job->box_transforms != NULL) {
+        is_hit = ((BoxCollider*) collider)->intersect(job->rays[ray_id], job->box_transforms[collider_id], &t);
+    }
+    else {
+        is_hit = collider->intersect(job->rays[ray_id], &t);
+    }
+
+    if (!is_hit || t > *max_t) {
+        return;
+    }
+
+    job->hits[ray_id].collider = ColliderHandle(collider_id, engine->collider_generations[collider_id]);
+    job->hits[ray_id].t = t;
+    *max_t = job->mode == RAYCAST_ANY ? -1.0 : t;
+}
+
+/*
+ * Casts count rays through the broadphase in packets, writing each ray's hit to the same
+ * index of hits. Only hits up to max_t along a ray count. The transforms of the boxes are
+ * built once for the whole batch, into the calling thread's scratch, rather than once per
+ * ray that reaches them, except for a single ray which reaches too few boxes for that to
+ * pay.
+ */
+void PhysicsEngine::raycast_batch(const ray *rays, int count, RaycastHit *hits, RaycastMode mode, float max_t) {
+    if (count > 1) {
+        query_scratch.box_transforms.resize(colliders.size());
+        for (int i = 0; i < colliders.size(); i++) {
+            if (colliders[i] != NULL && colliders[i]->shape == SHAPE_BOX) {
+                query_scratch.box_transforms[i] = colliders[i]->body.get_transform();
             }
         }
     }
 
-    return manifolds;
+    for (int i = 0; i < count; i++) {
+        hits[i].collider = ColliderHandle();
+        hits[i].t = max_t;
+    }
+
+    RaycastJob job;
+    job.engine = this;
+    job.rays = rays;
+    job.hits = hits;
+    job.mode = mode;
+    job.box_transforms = count > 1 ? query_scratch.box_transforms.data() : NULL;
+    broadphase->query_rays(rays, count, max_t, raycast_hit_callback, &job);
 }
 
-void PhysicsEngine::update(float dt) {
+/*
+ * Gives a collider that only exists for a query a body of its own, in the calling thread's
+ * scratch store, which holds just that body and just the fields the narrowphase reads.
+ * Queries never touch the world's store, so they can run side by side.
+ */
+static void init_query_collider(Collider *shape, const vec3 &position, const quat &orientation) {
+    RigidBodyStore *store = &query_scratch.store;
+    store->positions.assign(1, position);
+    store->orientations.assign(1, orientation);
+    store->velocities.assign(1, vec3(0.0, 0.0, 0.0));
+    store->angular_velocities.assign(1, vec3(0.0, 0.0, 0.0));
+
+    shape->id = -1;
+    shape->body = RigidBody(store, 0);
+}
+
+/*
+ * Conservative advancement of shape along displacement against other, like
+ * get_time_of_impact without the rotation. Each advance aims for a gap of half
+ * SWEEP_TOLERANCE and the shape stops once the gap is below SWEEP_TOLERANCE, so it never
+ * ends up inside other. A shape moving away from or along other, even one that starts out
+ * touching it, does not hit it. Returns the fraction of the sweep it stops at with the
+ * separating direction there, or max_t if it does not stop before max_t or is still short
+ * of the tolerance after every iteration.
+ */
+static float get_sweep_fraction(Collider *shape, Collider *other, const vec3 &start_position,
+        const vec3 &displacement, float max_t, vec3 *normal) {
+    DistanceFunction distance = distance_functions[shape->shape][other->shape];
+    if (distance == NULL) {
+        return max_t;
+    }
+
+    RigidBody *body = &shape->body;
+    body->position() = start_position;
+    float t = 0.0;
+
+    for (int i = 0; i < CONTINUOUS_MAX_ITERATIONS; i++) {
+        float gap = distance(shape, other, normal);
+        float closing_rate = -vec3::dot(displacement, *normal);
+        if (closing_rate <= 0.0) {
+            return max_t;
+        }
+
+        if (gap <= SWEEP_TOLERANCE) {
+            return t;
+        }
+
+        t += (gap - 0.5 * SWEEP_TOLERANCE) / closing_rate;
+        if (t >= max_t) {
+            return max_t;
+        }
+
+        body->position() = start_position + t * displacement;
+    }
+
+    float gap = distance(shape, other, normal);
+    if (gap <= SWEEP_TOLERANCE && vec3::dot(displacement, *normal) < 0.0) {
+        return t;
+    }
+
+    return max_t;
+}
+
+/*
+ * Sweeps shape from where it is along displacement and finds the first collider it
+ * touches among those the broadphase finds around the whole sweep. Leaves shape somewhere
+ * along the sweep.
+ */
+bool PhysicsEngine::sweep(Collider *shape, const vec3 &displacement, ShapeHit *hit) {
+    vec3 start_position = shape->body.position();
+    aabb start_box = shape->get_aabb();
+    aabb end_box = aabb(start_box.min + displacement, start_box.max + displacement);
+
+    std::vector<int> *candidates = &query_scratch.candidates;
+    candidates->clear();
+    broadphase->query_box(aabb::merge(start_box, end_box), candidates);
+
+    int hit_collider_id = -1;
+    float min_fraction = 1.0;
+    vec3 hit_normal;
+
+    for (int i = 0; i < candidates->size(); i++) {
+        vec3 normal;
+        float fraction = get_sweep_fraction(shape, colliders[(*candidates)[i]], start_position, displacement,
+                min_fraction, &normal);
+
+        if (fraction < min_fraction) {
+            hit_collider_id = (*candidates)[i];
+            min_fraction = fraction;
+            hit_normal = normal;
+        }
+    }
+
+    if (hit_collider_id == -1) {
+        return false;
+    }
+
+    hit->collider = ColliderHandle(hit_collider_id, collider_generations[hit_collider_id]);
+    hit->fraction = min_fraction;
+    hit->normal = hit_normal;
+    return true;
+}
+
+/*
+ * Runs the narrowphase kernels between shape and every collider the broadphase finds
+ * around it, and adds a hit for each one they find contacts with. The normal is that of
+ * the deepest contact.
+ */
+void PhysicsEngine::overlap(Collider *shape, std::vector<ShapeHit> *hits) {
+    std::vector<int> *candidates = &query_scratch.candidates;
+    candidates->clear();
+    broadphase->query_box(shape->get_aabb(), candidates);
+
+    for (int i = 0; i < candidates->size(); i++) {
+        int other_id = (*candidates)[i];
+        Collider *other = colliders[other_id];
+        CollideFunction collide = collide_functions[shape->shape][other->shape];
+        if (collide == NULL) {
+            continue;
+        }
+
+        PairCache cache;
+        ContactManifold manifold;
+        collide(shape, other, 0.0, &cache, &manifold);
+        if (manifold.num_contacts == 0) {
+            continue;
+        }
+
+        Contact *deepest = &manifold.contacts[0];
+        for (int j = 1; j < manifold.num_contacts; j++) {
+            if (manifold.contacts[j].penetration > deepest->penetration) {
+                deepest = &manifold.contacts[j];
+            }
+        }
+
+        ShapeHit hit;
+        hit.collider = ColliderHandle(other_id, collider_generations[other_id]);
+        hit.fraction = 0.0;
+        hit.normal = manifold.collider1 == shape ? -1.0 * deepest->normal : deepest->normal;
+        hits->push_back(hit);
+    }
+}
+
+/*
+ * Returns whether a sphere moved from center by displacement touches anything on the
+ * way, and the first collider it touches.
+ */
+bool PhysicsEngine::sphere_sweep(const vec3 &center, float radius, const vec3 &displacement, ShapeHit *hit) {
+    SphereCollider shape;
+    shape.radius = radius;
+    init_query_collider(&shape, center, quat());
+    return sweep(&shape, displacement, hit);
+}
+
+/*
+ * The box keeps its orientation along the sweep.
+ */
+bool PhysicsEngine::box_sweep(const vec3 &center, const vec3 &half_lengths, const quat &orientation,
+        const vec3 &displacement, ShapeHit *hit) {
+    BoxCollider shape;
+    shape.half_lengths = half_lengths;
+    init_query_collider(&shape, center, orientation);
+    return sweep(&shape, displacement, hit);
+}
+
+/*
+ * Adds every collider the sphere overlaps to hits.
+ */
+void PhysicsEngine::overlap_sphere(const vec3 &center, float radius, std::vector<ShapeHit> *hits) {
+    SphereCollider shape;
+    shape.radius = radius;
+    init_query_collider(&shape, center, quat());
+    overlap(&shape, hits);
+}
+
+void PhysicsEngine::overlap_box(const vec3 &center, const vec3 &half_lengths, const quat &orientation,
+        std::vector<ShapeHit> *hits) {
+    BoxCollider shape;
+    shape.half_lengths = half_lengths;
+    init_query_collider(&shape, center, orientation);
+    overlap(&shape, hits);
+}
+
+/*
+ * The queries work off the broadphase as it was left at the end of the last step. Bodies
+ * moved or added by hand since then are only found once this has been called.
+ */
+void PhysicsEngine::refit_broadphase() {
+    broadphase->refit(colliders);
+}
+
+/*
+ * Wakes every body of the sleeping island that collider_id belongs to. The bodies of a
+ * sleeping island are linked in a ring through sleep_links.
+ */
+void PhysicsEngine::wake_island(int collider_id) {
+    int i = collider_id;
+    colliders[i]->body.wake();
+
+    while (sleep_links[i] != -1) {
+        int next = sleep_links[i];
+        sleep_links[i] = -1;
+        i = next;
+        colliders[i]->body.wake();
+    }
+}
+
+/*
+ * Bodies woken from outside the engine, by apply_impulse or the editor, take the rest of
+ * their island with them.
+ */
+void PhysicsEngine::wake_woken_islands() {
     for (int i = 0; i < colliders.size(); i++) {
-        RigidBody *body = &colliders[i]->body;
-        body->add_force_at_point(vec3(0.0, -9.8 * body->mass, 0.0), body->position);
+        if (colliders[i] && !colliders[i]->body.is_sleeping() && sleep_links[i] != -1) {
+            wake_island(i);
+        }
+    }
+}
+
+/*
+ * An island falls asleep once every one of its bodies has stayed under the velocity
+ * thresholds for time_to_sleep.
+ */
+void PhysicsEngine::update_island_sleep(int island_id, float dt) {
+    float linear_threshold = sleep_linear_velocity * sleep_linear_velocity;
+    float angular_threshold = sleep_angular_velocity * sleep_angular_velocity;
+
+    Island *island = &island_builder.islands[island_id];
+    int *body_ids = &island_builder.body_ids[island->first_body];
+    float min_sleep_time = FLT_MAX;
+
+    for (int j = 0; j < island->num_bodies; j++) {
+        RigidBody *body = &colliders[body_ids[j]]->body;
+
+        if (body->velocity().length_squared() > linear_threshold
+                || body->angular_velocity().length_squared() > angular_threshold) {
+            body->sleep_time() = 0.0;
+        }
+        else {
+            body->sleep_time() += dt;
+        }
+
+        min_sleep_time = MIN(min_sleep_time, body->sleep_time());
+    }
+
+    if (!allow_sleeping || min_sleep_time < time_to_sleep) {
+        return;
+    }
+
+    for (int j = 0; j < island->num_bodies; j++) {
+        RigidBody *body = &colliders[body_ids[j]]->body;
+        body->sleep();
+        body->velocity() = vec3(0.0, 0.0, 0.0);
+        body->angular_velocity() = vec3(0.0, 0.0, 0.0);
+        body->reset_forces();
+
+        sleep_links[body_ids[j]] = body_ids[(j + 1) % island->num_bodies];
+    }
+}
+
+/*
+ * Makes room for n elements, at least doubling the capacity when it has to grow. assign
+ * and resize only grow to the size asked for, so a buffer whose size creeps up by a pair
+ * or two a step would reallocate on every new high.
+ */
+template <typename T>
+static void reserve_buffer(std::vector<T> *buffer, int n) {
+    if (n > buffer->capacity()) {
+        buffer->reserve(MAX(n, 2 * buffer->capacity()));
+    }
+}
+
+static long long get_pair_key(const BroadphasePair &pair) {
+    return ((long long) pair.collider1_id << 32) | pair.collider2_id;
+}
+
+/*
+ * Carries each pair's narrowphase cache over from the last step. Both pair lists are
+ * sorted, so one merge pass finds the pairs that were already there.
+ */
+void PhysicsEngine::load_pair_caches() {
+    reserve_buffer(&pair_caches, broadphase_pairs.size());
+    pair_caches.assign(broadphase_pairs.size(), PairCache());
+
+    int j = 0;
+    for (int i = 0; i < broadphase_pairs.size(); i++) {
+        long long key = get_pair_key(broadphase_pairs[i]);
+
+        while (j < last_broadphase_pairs.size() && get_pair_key(last_broadphase_pairs[j]) < key) {
+            j++;
+        }
+
+        if (j < last_broadphase_pairs.size() && get_pair_key(last_broadphase_pairs[j]) == key) {
+            pair_caches[i] = last_pair_caches[j];
+        }
+    }
+}
+
+/*
+ * Sorts the pair ids by the shapes of their colliders, so that each bucket of
+ * bucket_pair_ids from bucket_starts[b] to bucket_starts[b + 1] has one narrowphase kernel.
+ * Within a bucket the pairs stay in pair order.
+ */
+void PhysicsEngine::bucket_pairs() {
+    int num_pairs = broadphase_pairs.size();
+    int *pair_buckets = frame_arena.allocate<int>(num_pairs);
+    bucket_pair_ids = frame_arena.allocate<int>(num_pairs);
+
+    for (int b = 0; b <= NUM_SHAPES * NUM_SHAPES; b++) {
+        bucket_starts[b] = 0;
+    }
+
+    for (int i = 0; i < num_pairs; i++) {
+        int shape1 = colliders[broadphase_pairs[i].collider1_id]->shape;
+        int shape2 = colliders[broadphase_pairs[i].collider2_id]->shape;
+        pair_buckets[i] = shape1 * NUM_SHAPES + shape2;
+        bucket_starts[pair_buckets[i] + 1]++;
+    }
+
+    for (int b = 0; b < NUM_SHAPES * NUM_SHAPES; b++) {
+        bucket_starts[b + 1] += bucket_starts[b];
+    }
+
+    int next[NUM_SHAPES * NUM_SHAPES];
+    for (int b = 0; b < NUM_SHAPES * NUM_SHAPES; b++) {
+        next[b] = bucket_starts[b];
+    }
+
+    for (int i = 0; i < num_pairs; i++) {
+        bucket_pair_ids[next[pair_buckets[i]]++] = i;
+    }
+}
+
+struct CollideJob {
+    PhysicsEngine *engine;
+    CollideFunction collide;
+    int *pair_ids;
+    float dt;
+};
+
+/*
+ * How much closer two colliders can get in dt at their current velocities, counting the
+ * rotation of each at its bounding radius.
+ */
+static float get_speculative_margin(Collider *collider1, Collider *collider2, float dt) {
+    float speed = 0.0;
+
+    if (!collider1->body.is_static()) {
+        speed += collider1->body.velocity().length()
+            + collider1->body.angular_velocity().length() * collider1->get_bounding_radius();
+    }
+    if (!collider2->body.is_static()) {
+        speed += collider2->body.velocity().length()
+            + collider2->body.angular_velocity().length() * collider2->get_bounding_radius();
+    }
+
+    return speed * dt;
+}
+
+/*
+ * Runs one bucket's narrowphase kernel over a chunk of its pairs, pair i writing its
+ * manifold to slot i of the manifold buffer. With speculative contacts each pair reports
+ * contacts up to as far apart as it can close in the step.
+ */
+void PhysicsEngine::collide_pairs_task(void *data, int begin, int end) {
+    CollideJob *job = (CollideJob*) data;
+    PhysicsEngine *engine = job->engine;
+    CollideFunction collide = job->collide;
+
+    for (int k = begin; k < end; k++) {
+        int i = job->pair_ids[k];
+        Collider *collider1 = engine->colliders[engine->broadphase_pairs[i].collider1_id];
+        Collider *collider2 = engine->colliders[engine->broadphase_pairs[i].collider2_id];
+        ContactManifold *manifold = &engine->manifolds[i];
+        manifold->num_contacts = 0;
+
+        float margin = 0.0;
+        if (engine->speculative_contacts) {
+            margin = get_speculative_margin(collider1, collider2, job->dt);
+        }
+
+        collide(collider1, collider2, margin, &engine->pair_caches[i], manifold);
     }
+}
+
+static bool pair_key_less_than(const BroadphasePair &p1, const BroadphasePair &p2) {
+    return get_pair_key(p1) < get_pair_key(p2);
+}
 
-    for (int k = 0; k < 10; k++) {
-        std::vector<ContactManifold> manifolds = generate_contacts();
+/*
+ * A sleeping island wakes up when an awake body touches it, which the narrowphase decides
+ * rather than the boxes. Each pair of an awake and a sleeping body is tested with the cache
+ * and margin it gets in the narrowphase proper, so a pair that leaves its sleeper asleep
+ * has no contacts there either. The bodies woken are listed in woken_collider_ids.
+ */
+bool PhysicsEngine::wake_touched_islands(float dt) {
+    woken_collider_ids.clear();
 
-        for (int i = 0; i < manifolds.size(); i++) {
-            ContactManifold *manifold = &manifolds[i];
+    for (int i = 0; i < broadphase_pairs.size(); i++) {
+        Collider *collider1 = colliders[broadphase_pairs[i].collider1_id];
+        Collider *collider2 = colliders[broadphase_pairs[i].collider2_id];
 
-            Collider *collider1 = manifold->collider1;
-            Collider *collider2 = manifold->collider2;
+        int sleeping_id;
+        if (collider1->body.is_awake() && collider2->body.is_sleeping()) {
+            sleeping_id = collider2->id;
+        }
+        else if (collider2->body.is_awake() && collider1->body.is_sleeping()) {
+            sleeping_id = collider1->id;
+        }
+        else {
+            continue;
+        }
 
-            RigidBody *b1 = &collider1->body;
-            RigidBody *b2 = &collider2->body;
+        CollideFunction collide = collide_functions[collider1->shape][collider2->shape];
+        if (collide == NULL) {
+            continue;
+        }
+
+        PairCache cache;
+        std::vector<BroadphasePair>::iterator last = std::lower_bound(last_broadphase_pairs.begin(),
+                last_broadphase_pairs.end(), broadphase_pairs[i], pair_key_less_than);
+        if (last != last_broadphase_pairs.end() && get_pair_key(*last) == get_pair_key(broadphase_pairs[i])) {
+            cache = last_pair_caches[last - last_broadphase_pairs.begin()];
+        }
+
+        float margin = 0.0;
+        if (speculative_contacts) {
+            margin = get_speculative_margin(collider1, collider2, dt);
+        }
 
-            if (b1->is_static && b2->is_static) {
+        ContactManifold manifold;
+        collide(collider1, collider2, margin, &cache, &manifold);
+        if (manifold.num_contacts == 0) {
+            continue;
+        }
+
+        int j = sleeping_id;
+        do {
+            woken_collider_ids.push_back(j);
+            j = sleep_links[j];
+        } while (j != sleeping_id);
+
+        wake_island(sleeping_id);
+    }
+
+    return woken_collider_ids.size() > 0;
+}
+
+/*
+ * The broadphase does not report pairs between sleeping bodies, or between sleeping and
+ * static ones, so the islands woken this step are missing theirs. They are looked up around
+ * each woken body rather than by running the whole broadphase again. Pairs with islands
+ * that are still asleep are left for the next step, and keep the pair list sorted.
+ */
+void PhysicsEngine::add_woken_pairs() {
+    std::sort(woken_collider_ids.begin(), woken_collider_ids.end());
+
+    for (int i = 0; i < woken_collider_ids.size(); i++) {
+        int id = woken_collider_ids[i];
+        aabb box = colliders[id]->get_aabb();
+
+        woken_pair_candidates.clear();
+        broadphase->query_box(box, &woken_pair_candidates);
+
+        for (int j = 0; j < woken_pair_candidates.size(); j++) {
+            int other_id = woken_pair_candidates[j];
+            Collider *other = colliders[other_id];
+
+            /*
+             * Two woken colliders find each other from both ends, keep only one.
+             */
+            bool is_woken = std::binary_search(woken_collider_ids.begin(), woken_collider_ids.end(), other_id);
+            if (other_id == id || !(other->body.is_static() || (is_woken && other_id > id))) {
                 continue;
             }
 
-            float inv_mass_1 = b1->get_inv_mass();
-            float inv_mass_2 = b2->get_inv_mass();
+            if (!other->get_aabb().overlaps(box)) {
+                continue;
+            }
+
+            BroadphasePair pair;
+            pair.collider1_id = MIN(id, other_id);
+            pair.collider2_id = MAX(id, other_id);
+            broadphase_pairs.push_back(pair);
+        }
+    }
+
+    std::sort(broadphase_pairs.begin(), broadphase_pairs.end(), pair_key_less_than);
+}
+
+/*
+ * The pair and manifold buffers keep their capacity from step to step, so once they have
+ * grown to the number of pairs in the scene the narrowphase does not allocate. The pair
+ * lists of this step and the last are swapped rather than copied. Pairs without contacts
+ * are squeezed out afterwards, which keeps the manifolds in pair order.
+ */
+void PhysicsEngine::generate_contacts(float dt) {
+    broadphase->speculative_time = speculative_contacts ? dt : 0.0;
+    broadphase->find_pairs(colliders, &broadphase_pairs);
+    if (wake_touched_islands(dt)) {
+        add_woken_pairs();
+    }
+
+    int num_pairs = broadphase_pairs.size();
+    reserve_buffer(&manifolds, num_pairs);
+    manifolds.resize(num_pairs);
+
+    load_pair_caches();
+    bucket_pairs();
+
+    for (int b = 0; b < NUM_SHAPES * NUM_SHAPES; b++) {
+        CollideJob job;
+        job.engine = this;
+        job.collide = collide_functions[b / NUM_SHAPES][b % NUM_SHAPES];
+        job.pair_ids = bucket_pair_ids + bucket_starts[b];
+        job.dt = dt;
+        int count = bucket_starts[b + 1] - bucket_starts[b];
+
+        if (job.collide == NULL) {
+            for (int k = 0; k < count; k++) {
+                manifolds[job.pair_ids[k]].num_contacts = 0;
+            }
+            continue;
+        }
+
+        thread_pool.parallel_for(count, narrowphase_grain_size, collide_pairs_task, &job);
+    }
+
+    last_broadphase_pairs.swap(broadphase_pairs);
+    last_pair_caches.swap(pair_caches);
+
+    int num_manifolds = 0;
+    for (int i = 0; i < num_pairs; i++) {
+        if (manifolds[i].num_contacts > 0) {
+            if (i != num_manifolds) {
+                manifolds[num_manifolds] = manifolds[i];
+            }
+            num_manifolds++;
+        }
+    }
+    manifolds.resize(num_manifolds);
+
+    int n = num_colliders;
+    stats.num_colliders = n;
+    stats.num_possible_pairs = n * (n - 1) / 2;
+    stats.num_broadphase_pairs = num_pairs;
+    stats.num_contact_manifolds = manifolds.size();
+}
 
-            float inv_mass_sum = inv_mass_1 + inv_mass_2; 
+/*
+ * Anchor every contact point to both bodies. The arms r1 and r2 stay valid for all velocity
+ * iterations since positions only change at integration, and the local points let the
+ * position pass measure how far integration moved the bodies apart. Contacts that match
+ * one from the last step pick up its accumulated impulses.
+ */
+void PhysicsEngine::prepare_contacts() {
+    for (int i = 0; i < manifolds.size(); i++) {
+        ContactManifold *manifold = &manifolds[i];
 
-            for (int j = 0; j < manifold->contacts.size(); j++) {
-                Contact *contact = &manifold->contacts[j];
+        RigidBody *b1 = &manifold->collider1->body;
+        RigidBody *b2 = &manifold->collider2->body;
 
-                vec3 r1 = contact->position - b1->position;
-                vec3 r2 = contact->position - b2->position;
+        mat3 rotation_1 = b1->orientation().get_rotation();
+        mat3 rotation_2 = b2->orientation().get_rotation();
 
-                mat4 i1 = b1->get_inv_inertia_tensor();
-                mat4 i2 = b2->get_inv_inertia_tensor();
+        for (int j = 0; j < manifold->num_contacts; j++) {
+            Contact *contact = &manifold->contacts[j];
 
-                vec3 relative_velocity = (b2->velocity + vec3::cross(b2->angular_velocity, r2)) 
-                    - (b1->velocity + vec3::cross(b1->angular_velocity, r1));
-                vec3 relative_normal = contact->normal;
+            contact->r1 = contact->position - b1->position();
+            contact->r2 = contact->position - b2->position();
+            contact->local_point1 = rotation_1.transpose_multiply(contact->r1);
+            contact->local_point2 = rotation_2.transpose_multiply(contact->r2);
+        }
+    }
 
-                if (vec3::dot(relative_velocity, relative_normal) > 0.0) {
-                    continue;
-                }
+    if (!warm_starting) {
+        stats.num_warm_started_contacts = 0;
+        return;
+    }
 
-                float e = MIN(b1->restitution, b2->restitution);
-                float numerator = -(1.0 + e) * vec3::dot(relative_velocity, relative_normal);
-                float d1 = inv_mass_sum;
-                vec3 d2 = vec3::cross(i1 * vec3::cross(r1, relative_normal), r1);
-                vec3 d3 = vec3::cross(i2 * vec3::cross(r2, relative_normal), r2); 
-                float denominator = d1 + vec3::dot(relative_normal, d2 + d3);
+    contact_cache.match(&manifolds);
+    stats.num_warm_started_contacts = contact_cache.num_matched_contacts;
+}
 
-                float j_imp = numerator / (denominator * manifold->contacts.size());
-                if (denominator == 0.0) {
-                    j_imp = 0.0;
-                }
+void PhysicsEngine::correct_island_positions(int island_id) {
+    Island *island = &island_builder.islands[island_id];
 
-                vec3 impulse = j_imp * relative_normal;
+    for (int i = 0; i < island->num_manifolds; i++) {
+        ContactManifold *manifold = &manifolds[island_builder.manifold_ids[island->first_manifold + i]];
 
-                b1->apply_impulse((-1.0 * inv_mass_1) * impulse);
-                b2->apply_impulse(inv_mass_2 * impulse);
+        RigidBody *body1 = &manifold->collider1->body;
+        RigidBody *body2 = &manifold->collider2->body;
 
-                b1->angular_velocity = b1->angular_velocity - i1 * vec3::cross(r1, impulse);
-                b2->angular_velocity = b2->angular_velocity + i2 * vec3::cross(r2, impulse);
+        float inv_mass_1 = body1->get_inv_mass();
+        float inv_mass_2 = body2->get_inv_mass();
 
-                vec3 t = relative_velocity - vec3::dot(relative_velocity, relative_normal) * relative_normal;
-                if (ABS(t.length_squared()) < 0.001) {
-                    continue;
-                }
-                t = t.normalize();
+        if (inv_mass_1 + inv_mass_2 == 0.0) {
+            continue;
+        }
 
-                numerator = -vec3::dot(relative_velocity, t);
-                d1 = inv_mass_sum;
-                d2 = vec3::cross(i1 * vec3::cross(r1, t), r1);
-                d3 = vec3::cross(i2 * vec3::cross(r2, t), r2);
-                denominator = d1 + vec3::dot(t, d2 + d3);
-                if (denominator == 0.0) {
-                    continue;
-                }
+        mat3 rotation_1 = body1->orientation().get_rotation();
+        mat3 rotation_2 = body2->orientation().get_rotation();
 
-                float jt = numerator / denominator;
-                if (ABS(jt) < 0.001) {
-                    continue;
-                }
+        for (int j = 0; j < manifold->num_contacts; j++) {
+            Contact *contact = &manifold->contacts[j];
 
-                float friction = sqrt(b1->friction * b2->friction);
-                if (jt > j_imp * friction) {
-                    jt = j_imp * friction;
-                }
-                if (jt < -j_imp * friction) {
-                    jt = -j_imp * friction;
-                }
+            vec3 point1 = body1->position() + rotation_1 * contact->local_point1;
+            vec3 point2 = body2->position() + rotation_2 * contact->local_point2;
+            float penetration = contact->penetration - vec3::dot(point2 - point1, contact->normal);
 
-                vec3 tangent_impulse = jt * t;
+            float depth = MAX(penetration - 0.005, 0.0);
+            float scalar = depth / (inv_mass_1 + inv_mass_2);
+            vec3 correction = 0.2 * scalar * contact->normal;
 
-                b1->apply_impulse((-1.0 * inv_mass_1) * tangent_impulse);
-                b2->apply_impulse(inv_mass_2 * tangent_impulse);
+            if (body1->is_awake()) {
+                body1->position() = body1->position() - inv_mass_1 * correction;
+            }
 
-                b1->angular_velocity = b1->angular_velocity - i1 * vec3::cross(r1, tangent_impulse);
-                b2->angular_velocity = b2->angular_velocity + i2 * vec3::cross(r2, tangent_impulse);
+            if (body2->is_awake()) {
+                body2->position() = body2->position() + inv_mass_2 * correction;
             }
         }
     }
+}
 
-    for (int i = 0; i < colliders.size(); i++) {
-        colliders[i]->body.update(dt);
+/*
+ * Everything after the velocity solve that only touches the island's own bodies and
+ * contacts.
+ */
+void PhysicsEngine::finish_island(int island_id, float dt) {
+    if (warm_starting) {
+        contact_solver.store_island_impulses(island_id);
     }
 
-    {
-        std::vector<ContactManifold> manifolds = generate_contacts();
+    update_island_sleep(island_id, dt);
+}
+
+struct IslandsJob {
+    PhysicsEngine *engine;
+    float dt;
+};
 
-        for (int i = 0; i < manifolds.size(); i++) {
-            ContactManifold *manifold = &manifolds[i];
+void PhysicsEngine::solve_islands_task(void *data, int begin, int end) {
+    IslandsJob *job = (IslandsJob*) data;
+    PhysicsEngine *engine = job->engine;
 
-            RigidBody *body1 = &manifold->collider1->body; 
-            RigidBody *body2 = &manifold->collider2->body; 
+    for (int i = begin; i < end; i++) {
+        if (engine->contact_solver.is_split_island(i)) {
+            continue;
+        }
 
-            float inv_mass_1 = body1->get_inv_mass();
-            float inv_mass_2 = body2->get_inv_mass();
+        engine->contact_solver.init_island(i, engine->warm_starting);
 
-            for (int j = 0; j < manifold->contacts.size(); j++) {
-                Contact *contact = &manifold->contacts[j];
+        if (engine->substeps > 1) {
+            engine->contact_solver.solve_island_substeps(i, engine->substeps, job->dt);
+        }
+        else {
+            engine->contact_solver.solve_island(i, engine->velocity_iterations);
+        }
 
-                float depth = MAX(contact->penetration - 0.005, 0.0);
-                float scalar = depth / (inv_mass_1 + inv_mass_2);
-                vec3 correction = 0.2 * scalar * contact->normal;
+        engine->finish_island(i, job->dt);
+    }
+}
+
+void PhysicsEngine::correct_positions_task(void *data, int begin, int end) {
+    IslandsJob *job = (IslandsJob*) data;
+
+    for (int i = begin; i < end; i++) {
+        job->engine->correct_island_positions(i);
+    }
+}
 
-                if (!body1->is_static) {
-                    body1->position = body1->position - inv_mass_1 * correction;
-                }
+/*
+ * Islands share no dynamic bodies, so each one is solved as a single task on the thread
+ * pool. The few islands too large for one thread are done afterwards with their
+ * constraints spread over the pool instead.
+ */
+void PhysicsEngine::solve_islands(float dt) {
+    contact_solver.init(&bodies, &manifolds, &island_builder, &frame_arena, dt);
 
-                if (!body2->is_static) {
-                    body2->position = body2->position + inv_mass_2 * correction;
-                }
+    IslandsJob job;
+    job.engine = this;
+    job.dt = dt;
+    thread_pool.parallel_for(island_builder.num_islands, 1, solve_islands_task, &job);
+
+    for (int i = 0; i < island_builder.num_islands; i++) {
+        if (!contact_solver.is_split_island(i)) {
+            continue;
+        }
+
+        contact_solver.init_island(i, warm_starting);
+
+        if (substeps > 1) {
+            contact_solver.solve_split_island_substeps(i, substeps, dt, &thread_pool);
+        }
+        else {
+            contact_solver.solve_split_island(i, velocity_iterations, &thread_pool);
+        }
+
+        finish_island(i, dt);
+    }
+
+    if (warm_starting) {
+        contact_cache.store(manifolds);
+    }
+}
+
+void PhysicsEngine::correct_positions() {
+    IslandsJob job;
+    job.engine = this;
+    job.dt = 0.0;
+    thread_pool.parallel_for(island_builder.num_islands, 1, correct_positions_task, &job);
+}
+
+/*
+ * Remembers where the awake continuous bodies start the step, so advance_continuous_bodies
+ * can sweep them from there to where integration takes them.
+ */
+void PhysicsEngine::save_continuous_start_poses() {
+    int n = bodies.size();
+    num_continuous_bodies = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (bodies.continuous_flags[i] && bodies.is_awake(i)) {
+            num_continuous_bodies++;
+        }
+    }
+
+    continuous_body_ids = frame_arena.allocate<int>(num_continuous_bodies);
+    continuous_start_positions = frame_arena.allocate<vec3>(num_continuous_bodies);
+    continuous_start_orientations = frame_arena.allocate<quat>(num_continuous_bodies);
+    num_continuous_bodies = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (bodies.continuous_flags[i] && bodies.is_awake(i)) {
+            continuous_body_ids[num_continuous_bodies] = i;
+            continuous_start_positions[num_continuous_bodies] = bodies.positions[i];
+            continuous_start_orientations[num_continuous_bodies] = bodies.orientations[i];
+            num_continuous_bodies++;
+        }
+    }
+}
+
+/*
+ * Conservative advancement of collider along its motion for the step, against other held
+ * at its current pose. The gap along the separating direction can close no faster than
+ * the motion towards other along it plus rotation_bound, so moving on by the gap over
+ * that rate can't carry collider more than CONTINUOUS_PENETRATION past where it should
+ * stop. Colliders that start apart stop when they touch. Colliders that start touching
+ * stop once they are CONTINUOUS_PENETRATION deeper than they started, which is left to
+ * the contacts unless the body is on its way through. Returns the fraction of the step at
+ * which collider stops, max_t if not before max_t. Leaves collider somewhere along its
+ * motion.
+ */
+float PhysicsEngine::get_time_of_impact(Collider *collider, Collider *other, const vec3 &start_position,
+        const quat &start_orientation, const vec3 &end_position, const quat &end_orientation,
+        float rotation_bound, float max_t) {
+    DistanceFunction distance = distance_functions[collider->shape][other->shape];
+    if (distance == NULL) {
+        return max_t;
+    }
+
+    RigidBody *body = &collider->body;
+    vec3 displacement = end_position - start_position;
+    vec3 normal;
+
+    body->position() = start_position;
+    body->orientation() = start_orientation;
+
+    float gap = distance(collider, other, &normal);
+    float stop_gap = gap > 0.0 ? 0.0 : gap - CONTINUOUS_PENETRATION;
+    float min_gap = stop_gap - CONTINUOUS_PENETRATION;
+    float t = 0.0;
+
+    for (int i = 0; i < CONTINUOUS_MAX_ITERATIONS; i++) {
+        float closing_rate = rotation_bound - vec3::dot(displacement, normal);
+        if (closing_rate <= 0.0) {
+            return max_t;
+        }
+
+        t += (gap - min_gap) / closing_rate;
+        if (t >= max_t) {
+            return max_t;
+        }
+
+        body->position() = start_position + t * displacement;
+        body->orientation() = quat::nlerp(start_orientation, end_orientation, t);
+
+        gap = distance(collider, other, &normal);
+        if (gap <= stop_gap) {
+            return t;
+        }
+    }
+
+    /*
+     * Still short of stopping after every iteration, stopping here is early but never late.
+     */
+    return t;
+}
+
+/*
+ * Sweeps every continuous body that moved further this step than the discrete contacts
+ * can be trusted with, and steps it back to its first impact along the way. Only those
+ * bodies are re-stepped. Each keeps its velocity and gives up the rest of its step, so
+ * the next step finds it just touching what it hit and the solver takes over.
+ */
+void PhysicsEngine::advance_continuous_bodies() {
+    stats.num_continuous_impacts = 0;
+
+    for (int k = 0; k < num_continuous_bodies; k++) {
+        int id = continuous_body_ids[k];
+        Collider *collider = colliders[id];
+        RigidBody *body = &collider->body;
+
+        if (!body->is_awake()) {
+            continue;
+        }
+
+        vec3 start_position = continuous_start_positions[k];
+        quat start_orientation = continuous_start_orientations[k];
+        vec3 end_position = body->position();
+        quat end_orientation = body->orientation();
+
+        /*
+         * Points turn at most 4 tan(angle / 4) radians over an nlerp that turns angle in
+         * total, a little more than angle itself.
+         */
+        float cos_half_angle = ABS(start_orientation.x * end_orientation.x + start_orientation.y * end_orientation.y
+                + start_orientation.z * end_orientation.z + start_orientation.w * end_orientation.w);
+        float angle = 2.0 * acosf(MIN(cos_half_angle, 1.0));
+        float rotation_bound = 4.0 * tanf(0.25 * angle) * collider->get_bounding_radius();
+        vec3 displacement = end_position - start_position;
+        float motion_bound = displacement.length() + rotation_bound;
+
+        if (motion_bound <= collider->get_inner_radius()) {
+            continue;
+        }
+
+        aabb end_box = collider->get_aabb();
+        aabb start_box = aabb(end_box.min - displacement, end_box.max - displacement);
+        aabb swept_box = aabb::merge(start_box, end_box).expand(rotation_bound);
+
+        continuous_candidates.clear();
+        broadphase->query_box(swept_box, &continuous_candidates);
+
+        float time_of_impact = 1.0;
+
+        for (int i = 0; i < continuous_candidates.size(); i++) {
+            if (continuous_candidates[i] == id) {
+                continue;
             }
+
+            time_of_impact = get_time_of_impact(collider, colliders[continuous_candidates[i]], start_position,
+                    start_orientation, end_position, end_orientation, rotation_bound, time_of_impact);
+        }
+
+        if (time_of_impact < 1.0) {
+            body->position() = start_position + time_of_impact * displacement;
+            body->orientation() = quat::nlerp(start_orientation, end_orientation, time_of_impact);
+            stats.num_continuous_impacts++;
+        }
+        else {
+            body->position() = end_position;
+            body->orientation() = end_orientation;
         }
     }
+}
+
+/*
+ * Collision detection runs once per step, the velocity iterations and the position pass
+ * all work off the same manifolds. Sleeping bodies are skipped everywhere, so collision
+ * detection, which wakes the islands that get touched, comes before gravity and the world
+ * space inertia. The islands and solver constraints are allocated from frame_arena and
+ * live until the next step.
+ *
+ * With substeps above one the velocity iterations are replaced by that many substeps of
+ * one iteration each, and the islands integrate their own bodies between them. Continuous
+ * bodies are swept once everything has moved and before the position pass.
+ *
+ * With speculative_contacts the narrowphase also reports pairs that are close enough to
+ * touch within the step, and the solver lets them close no more than the gap. That keeps
+ * fast bodies out of thin ones without a second collision pass.
+ */
+void PhysicsEngine::step(float dt) {
+    frame_arena.reset();
+    wake_woken_islands();
+    generate_contacts(dt);
+
+    bodies.update_inv_masses();
+    bodies.apply_gravity(vec3(0.0, -9.8, 0.0));
+    bodies.update_inertia_tensors_world();
+
+    prepare_contacts();
+    island_builder.build(colliders, manifolds, &frame_arena);
+
+    save_continuous_start_poses();
+    solve_islands(dt);
+    if (substeps <= 1) {
+        bodies.integrate(dt);
+    }
+    advance_continuous_bodies();
+    correct_positions();
+    broadphase->refit(colliders);
+
+    stats.num_islands = island_builder.num_islands;
+    stats.arena_high_water_mark = frame_arena.high_water_mark;
+    stats.num_collider_slots = colliders.size();
+    stats.num_pooled_colliders = box_colliders.get_capacity() + sphere_colliders.get_capacity()
+        + plane_colliders.get_capacity();
+    stats.num_broadphase_nodes = broadphase->get_num_nodes();
+    stats.num_awake_bodies = 0;
+    stats.num_sleeping_bodies = 0;
 
     for (int i = 0; i < colliders.size(); i++) {
         Collider *collider = colliders[i];
-        collider->update_transform(&(scene->transforms[collider->transform_id]));
+        if (collider == NULL) {
+            continue;
+        }
 
         RigidBody *body = &collider->body;
+
+        if (body->is_sleeping()) {
+            stats.num_sleeping_bodies++;
+            continue;
+        }
+
+        if (!body->is_static()) {
+            stats.num_awake_bodies++;
+        }
+
         body->reset_forces();
     }
 }
+
+void PhysicsEngine::save_previous_poses() {
+    previous_positions = bodies.positions;
+    previous_orientations = bodies.orientations;
+    previous_generations = collider_generations;
+}
+
+/*
+ * Writes every awake collider into its transform, alpha of the way from its pose before
+ * the last step to its current one. Colliders added since the poses were saved, or whose
+ * slot has been reused since, are written at their current pose.
+ */
+void PhysicsEngine::sync_transforms(float alpha) {
+    if (transforms == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < colliders.size(); i++) {
+        Collider *collider = colliders[i];
+        if (collider == NULL || collider->body.is_sleeping()) {
+            continue;
+        }
+
+        vec3 position = bodies.positions[i];
+        quat orientation = bodies.orientations[i];
+
+        if (alpha < 1.0 && i < previous_generations.size() && previous_generations[i] == collider_generations[i]) {
+            position = (1.0 - alpha) * previous_positions[i] + alpha * position;
+            orientation = quat::nlerp(previous_orientations[i], orientation, alpha);
+        }
+
+        collider->set_transform(&(*transforms)[collider->transform_id], position, orientation);
+    }
+}
+
+/*
+ * Advances the world by dt in one step and writes the transforms at the new poses.
+ */
+void PhysicsEngine::update(float dt) {
+    step(dt);
+    interpolation_alpha = 1.0;
+    sync_transforms(1.0);
+}
+
+/*
+ * Advances the world by real_dt of wall clock time in steps of fixed_dt, so the simulation
+ * runs at the same rate however fast frames come. Time short of a whole step is carried
+ * over to the next call and becomes interpolation_alpha, the fraction of a step the
+ * transforms are blended forward from the pose before the last step. At most max_substeps
+ * steps run per call, time beyond that is dropped so a slow frame can't snowball.
+ */
+void PhysicsEngine::step_for(float real_dt) {
+    accumulator += real_dt;
+
+    int num_steps = (int) (accumulator / fixed_dt);
+
+    if (num_steps > max_substeps) {
+        num_steps = max_substeps;
+        accumulator = fmodf(accumulator, fixed_dt) + num_steps * fixed_dt;
+    }
+
+    for (int i = 0; i < num_steps; i++) {
+        if (i == num_steps - 1) {
+            save_previous_poses();
+        }
+
+        step(fixed_dt);
+        accumulator -= fixed_dt;
+    }
+
+    interpolation_alpha = MAX(0.0, MIN(accumulator / fixed_dt, 1.0));
+    sync_transforms(interpolation_alpha);
+}
@@ -3,21 +3,192 @@
 #include <vector>
 
 #include "maths.h"
-#include "scene.h"
+#include "transform.h"
+#include "rigid_body.h"
 #include "collide_fine.h"
+#include "broadphase.h"
+#include "aabb_tree.h"
+#include "contact_cache.h"
+#include "contact_solver.h"
+#include "island.h"
+#include "thread_pool.h"
+#include "frame_arena.h"
+#include "collider_pool.h"
+
+#define CONTINUOUS_PENETRATION 0.01
+#define CONTINUOUS_MAX_ITERATIONS 20
+#define SWEEP_TOLERANCE 0.001
+
+struct PhysicsStats {
+    int num_colliders;
+    int num_possible_pairs;
+    int num_broadphase_pairs;
+    int num_contact_manifolds;
+    int num_warm_started_contacts;
+    int num_islands;
+    int num_awake_bodies;
+    int num_sleeping_bodies;
+    int arena_high_water_mark;
+    int num_continuous_impacts;
+    int num_collider_slots;
+    int num_pooled_colliders;
+    int num_broadphase_nodes;
+
+    PhysicsStats();
+};
+
+/*
+ * Names a collider for as long as it exists. id is the collider's slot in colliders and
+ * generation counts how many colliders have had that slot before, so a handle to a removed
+ * collider never resolves to the one that took its slot.
+ */
+struct ColliderHandle {
+    int id;
+    int generation;
+
+    ColliderHandle();
+    ColliderHandle(int id, int generation);
+};
+
+/*
+ * RAYCAST_CLOSEST finds the first collider along each ray. RAYCAST_ANY stops at whichever
+ * hit it finds first, for rays that only need to know whether anything is in the way.
+ */
+enum RaycastMode {
+    RAYCAST_CLOSEST,
+    RAYCAST_ANY
+};
+
+/*
+ * The collider a ray hit and the ray time of the hit, or a handle with id -1 if it hit
+ * nothing.
+ */
+struct RaycastHit {
+    ColliderHandle collider;
+    float t;
+};
+
+/*
+ * A collider a shape query found. fraction is how far along its sweep the shape gets
+ * before touching the collider, 0 for overlaps and shapes that start out touching. normal
+ * points from the collider towards the shape.
+ */
+struct ShapeHit {
+    ColliderHandle collider;
+    float fraction;
+    vec3 normal;
+};
 
 class PhysicsEngine {
     private:
-        std::vector<ContactManifold> generate_contacts();
+        Broadphase *broadphase;
+        std::vector<BroadphasePair> broadphase_pairs;
+        std::vector<PairCache> pair_caches;
+        std::vector<BroadphasePair> last_broadphase_pairs;
+        std::vector<PairCache> last_pair_caches;
+        std::vector<ContactManifold> manifolds;
+        int *bucket_pair_ids;
+        int bucket_starts[NUM_SHAPES * NUM_SHAPES + 1];
+        ContactCache contact_cache;
+        ContactSolver contact_solver;
+        IslandBuilder island_builder;
+        ThreadPool thread_pool;
+        FrameArena frame_arena;
+        std::vector<int> sleep_links;
+        std::vector<int> woken_collider_ids;
+        std::vector<int> woken_pair_candidates;
+
+        ColliderPool<BoxCollider> box_colliders;
+        ColliderPool<SphereCollider> sphere_colliders;
+        ColliderPool<PlaneCollider> plane_colliders;
+        std::vector<int> collider_generations;
+        std::vector<int> free_collider_ids;
+        std::vector<int> removal_candidates;
+
+        int *continuous_body_ids;
+        vec3 *continuous_start_positions;
+        quat *continuous_start_orientations;
+        int num_continuous_bodies;
+        std::vector<int> continuous_candidates;
+
+        std::vector<vec3> previous_positions;
+        std::vector<quat> previous_orientations;
+        std::vector<int> previous_generations;
+        float accumulator;
+
+        ColliderHandle add_collider(Collider *collider, int transform_id);
+        void free_collider(Collider *collider);
+        void forget_pair_caches(int collider_id);
+        void wake_island(int collider_id);
+        void wake_woken_islands();
+        bool wake_touched_islands(float dt);
+        void add_woken_pairs();
+        void update_island_sleep(int island_id, float dt);
+        void load_pair_caches();
+        void bucket_pairs();
+        void generate_contacts(float dt);
+        void prepare_contacts();
+        void correct_island_positions(int island_id);
+        void finish_island(int island_id, float dt);
+        void solve_islands(float dt);
+        void correct_positions();
+        void save_continuous_start_poses();
+        float get_time_of_impact(Collider *collider, Collider *other, const vec3 &start_position,
+                const quat &start_orientation, const vec3 &end_position, const quat &end_orientation,
+                float rotation_bound, float max_t);
+        void advance_continuous_bodies();
+        bool sweep(Collider *shape, const vec3 &displacement, ShapeHit *hit);
+        void overlap(Collider *shape, std::vector<ShapeHit> *hits);
+        void step(float dt);
+        void save_previous_poses();
+        void sync_transforms(float alpha);
+
+        static void collide_pairs_task(void *data, int begin, int end);
+        static void raycast_hit_callback(void *data, int ray_id, int collider_id, float *max_t);
+        static void solve_islands_task(void *data, int begin, int end);
+        static void correct_positions_task(void *data, int begin, int end);
 
     public:
+        RigidBodyStore bodies;
         std::vector<Collider*> colliders;
-        Scene *scene;
+        int num_colliders;
+        std::vector<Transform> *transforms;
+        PhysicsStats stats;
+        int velocity_iterations;
+        int substeps;
+        int narrowphase_grain_size;
+        bool warm_starting;
+        bool speculative_contacts;
+
+        bool allow_sleeping;
+        float sleep_linear_velocity;
+        float sleep_angular_velocity;
+        float time_to_sleep;
+
+        float fixed_dt;
+        int max_substeps;
+        float interpolation_alpha;
 
+        PhysicsEngine();
+        void set_broadphase(Broadphase *broadphase);
+        void set_num_threads(int num_threads);
+        int get_num_threads();
         void init_contact_manifolds();
-        int add_cube_collider(int transform_id, const vec3 &half_lengths);
-        int add_sphere_collider(int transform_id, float radius);
-        int add_plane_collider(int transform_id);
+        ColliderHandle add_cube_collider(int transform_id, const vec3 &half_lengths);
+        ColliderHandle add_sphere_collider(int transform_id, float radius);
+        ColliderHandle add_plane_collider(int transform_id);
+        void remove_collider(ColliderHandle handle);
+        Collider *get_collider(ColliderHandle handle);
+        ColliderHandle raycast(ray r, float *t_out);
+        void raycast_batch(const ray *rays, int count, RaycastHit *hits, RaycastMode mode = RAYCAST_CLOSEST,
+                float max_t = FLT_MAX);
+        bool sphere_sweep(const vec3 &center, float radius, const vec3 &displacement, ShapeHit *hit);
+        bool box_sweep(const vec3 &center, const vec3 &half_lengths, const quat &orientation, const vec3 &displacement,
+                ShapeHit *hit);
+        void overlap_sphere(const vec3 &center, float radius, std::vector<ShapeHit> *hits);
+        void overlap_box(const vec3 &center, const vec3 &half_lengths, const quat &orientation, std::vector<ShapeHit> *hits);
+        void refit_broadphase();
 
         void update(float dt);
+        void step_for(float real_dt);
 };
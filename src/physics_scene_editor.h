@@ -7,14 +7,18 @@
 
 class PhysicsSceneEditor {
     private:
+        Scene *scene;
         PhysicsEngine *physics_engine;
         Controls *controls;
-        int selected_collider_id;
+        ColliderHandle selected_collider_handle;
+        int selected_instance_id;
         float selected_collider_distance;
         int selected_axis;
         bool is_rotating_collider, is_scaling_collider;
 
+        int find_instance(int transform_id);
+
     public:
-        PhysicsSceneEditor(PhysicsEngine *physics_engine, Controls *controls);
+        PhysicsSceneEditor(Scene *scene, PhysicsEngine *physics_engine, Controls *controls);
         void update(float dt);
 };
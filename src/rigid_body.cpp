@@ -1,89 +1,346 @@
 #include "rigid_body.h"
 
+int RigidBodyStore::create_body() {
+    int body_id = positions.size();
+
+    positions.resize(body_id + 1);
+    orientations.resize(body_id + 1);
+    velocities.resize(body_id + 1);
+    angular_velocities.resize(body_id + 1);
+
+    masses.resize(body_id + 1);
+    inv_masses.resize(body_id + 1);
+    inertia_tensors.resize(body_id + 1);
+    inv_inertia_tensors.resize(body_id + 1);
+    inv_inertia_tensors_world.resize(body_id + 1);
+
+    force_accumulators.resize(body_id + 1);
+    torque_accumulators.resize(body_id + 1);
+
+    restitutions.resize(body_id + 1);
+    frictions.resize(body_id + 1);
+
+    static_flags.resize(body_id + 1);
+    sleeping_flags.resize(body_id + 1);
+    continuous_flags.resize(body_id + 1);
+    sleep_times.resize(body_id + 1);
+
+    reset_body(body_id);
+    return body_id;
+}
+
+/*
+ * Puts a new or reused body into its initial state.
+ */
+void RigidBodyStore::reset_body(int body_id) {
+    positions[body_id] = vec3(0.0, 0.0, 0.0);
+    orientations[body_id] = quat(vec3(1.0, 0.0, 0.0), 0.0);
+    velocities[body_id] = vec3(0.0, 0.0, 0.0);
+    angular_velocities[body_id] = vec3(0.0, 0.0, 0.0);
+
+    masses[body_id] = 1.0;
+    inv_masses[body_id] = 1.0;
+    inertia_tensors[body_id] = mat3::identity();
+    inv_inertia_tensors[body_id] = mat3::identity();
+    inv_inertia_tensors_world[body_id] = mat3::identity();
+
+    force_accumulators[body_id] = vec3(0.0, 0.0, 0.0);
+    torque_accumulators[body_id] = vec3(0.0, 0.0, 0.0);
+
+    restitutions[body_id] = 0.0;
+    frictions[body_id] = 0.0;
+
+    static_flags[body_id] = false;
+    sleeping_flags[body_id] = false;
+    continuous_flags[body_id] = false;
+    sleep_times[body_id] = 0.0;
+}
+
+void RigidBodyStore::free_body(int body_id) {
+    reset_body(body_id);
+    static_flags[body_id] = true;
+    inv_masses[body_id] = 0.0;
+}
+
+int RigidBodyStore::size() {
+    return positions.size();
+}
+
+bool RigidBodyStore::is_awake(int body_id) {
+    return !static_flags[body_id] && !sleeping_flags[body_id];
+}
+
+/*
+ * Static bodies and bodies without mass get an inverse mass of zero, so the solver can
+ * treat every body the same.
+ */
+void RigidBodyStore::update_inv_masses() {
+    int n = size();
+    for (int i = 0; i < n; i++) {
+        bool has_mass = !static_flags[i] && masses[i] != 0.0;
+        inv_masses[i] = has_mass ? 1.0 / masses[i] : 0.0;
+    }
+}
+
+void RigidBodyStore::apply_gravity(const vec3 &gravity) {
+    int n = size();
+    for (int i = 0; i < n; i++) {
+        if (!is_awake(i)) {
+            continue;
+        }
+
+        force_accumulators[i] = force_accumulators[i] + masses[i] * gravity;
+    }
+}
+
+/*
+ * Rotates the body space inverse inertia of every awake body into world space,
+ * R * I^-1 * R^T.
+ */
+void RigidBodyStore::update_inertia_tensors_world() {
+    int n = size();
+    for (int i = 0; i < n; i++) {
+        if (!is_awake(i)) {
+            continue;
+        }
+
+        mat3 rotation = orientations[i].get_rotation();
+        inv_inertia_tensors_world[i] = rotation * inv_inertia_tensors[i] * rotation.transpose();
+    }
+}
+
+/*
+ * Semi-implicit Euler over every awake body, with the velocities damped by 2% a step.
+ */
+void RigidBodyStore::integrate(float dt) {
+    int n = size();
+
+    for (int i = 0; i < n; i++) {
+        if (!is_awake(i)) {
+            continue;
+        }
+
+        vec3 velocity = velocities[i] + (dt * inv_masses[i]) * force_accumulators[i];
+        velocities[i] = VELOCITY_DAMPING * velocity;
+        positions[i] = positions[i] + dt * velocities[i];
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!is_awake(i)) {
+            continue;
+        }
+
+        vec3 angular_velocity = angular_velocities[i] + dt * (inv_inertia_tensors_world[i] * torque_accumulators[i]);
+        angular_velocities[i] = VELOCITY_DAMPING * angular_velocity;
+        orientations[i] = quat(angular_velocities[i], dt) * orientations[i];
+    }
+}
+
+/*
+ * The two halves of integrate for a list of awake bodies, so a substep can solve contacts
+ * between taking the forces in and moving the bodies. damping is applied once per call.
+ */
+void RigidBodyStore::integrate_velocities(const int *body_ids, int num_bodies, float dt, float damping) {
+    for (int j = 0; j < num_bodies; j++) {
+        int i = body_ids[j];
+
+        vec3 velocity = velocities[i] + (dt * inv_masses[i]) * force_accumulators[i];
+        velocities[i] = damping * velocity;
+
+        vec3 angular_velocity = angular_velocities[i] + dt * (inv_inertia_tensors_world[i] * torque_accumulators[i]);
+        angular_velocities[i] = damping * angular_velocity;
+    }
+}
+
+void RigidBodyStore::integrate_positions(const int *body_ids, int num_bodies, float dt) {
+    for (int j = 0; j < num_bodies; j++) {
+        int i = body_ids[j];
+
+        positions[i] = positions[i] + dt * velocities[i];
+        orientations[i] = quat(angular_velocities[i], dt) * orientations[i];
+    }
+}
+
 RigidBody::RigidBody() {
-    position = vec3(0.0, 0.0, 0.0);
-    orientation = quat(vec3(1.0, 0.0, 0.0), 0.0);
-    mass = 1.0;
-    inertia_tensor = mat4::identity();
-    restitution = 0.0;
-    friction = 0.0;
-    is_static = false;
+    store = NULL;
+    id = -1;
+}
+
+RigidBody::RigidBody(RigidBodyStore *store, int id) {
+    this->store = store;
+    this->id = id;
+}
+
+vec3 &RigidBody::position() {
+    return store->positions[id];
+}
+
+quat &RigidBody::orientation() {
+    return store->orientations[id];
+}
+
+vec3 &RigidBody::velocity() {
+    return store->velocities[id];
+}
+
+vec3 &RigidBody::angular_velocity() {
+    return store->angular_velocities[id];
+}
+
+float &RigidBody::mass() {
+    return store->masses[id];
+}
+
+float &RigidBody::restitution() {
+    return store->restitutions[id];
+}
+
+float &RigidBody::friction() {
+    return store->frictions[id];
+}
+
+float &RigidBody::sleep_time() {
+    return store->sleep_times[id];
+}
+
+vec3 &RigidBody::force_accumulator() {
+    return store->force_accumulators[id];
+}
+
+vec3 &RigidBody::torque_accumulator() {
+    return store->torque_accumulators[id];
+}
+
+bool RigidBody::is_static() {
+    return store->static_flags[id];
+}
+
+void RigidBody::set_static(bool is_static) {
+    store->static_flags[id] = is_static;
+}
+
+/*
+ * Continuous bodies are swept against the world each step and stopped at their first
+ * impact, so they can't pass through thin colliders however fast they move.
+ */
+bool RigidBody::is_continuous() {
+    return store->continuous_flags[id];
+}
+
+void RigidBody::set_continuous(bool is_continuous) {
+    store->continuous_flags[id] = is_continuous;
+}
+
+bool RigidBody::is_sleeping() {
+    return store->sleeping_flags[id];
+}
+
+void RigidBody::sleep() {
+    store->sleeping_flags[id] = true;
 }
 
 void RigidBody::add_force_at_point(const vec3 &force, const vec3 &point) {
-    force_accumulator = force_accumulator + force;
+    force_accumulator() = force_accumulator() + force;
+}
+
+rigid_transform RigidBody::get_transform() {
+    return rigid_transform(orientation(), position());
 }
 
 float RigidBody::get_inv_mass() {
-    if (is_static || mass == 0.0) {
+    if (is_static() || mass() == 0.0) {
         return 0.0;
     }
-    
-    return 1.0 / mass;
+
+    return 1.0 / mass();
 }
 
-mat4 RigidBody::get_inv_inertia_tensor() {
-    if (is_static || mass == 0.0) {
-        return mat4::zero();
+/*
+ * World space inverse inertia as of the last update_inertia_tensor_world.
+ */
+mat3 RigidBody::get_inv_inertia_tensor() {
+    if (is_static() || mass() == 0.0) {
+        return mat3::zero();
     }
 
-    return inertia_tensor.inverse();
+    return store->inv_inertia_tensors_world[id];
 }
 
-void RigidBody::update(float dt) {
-    if (is_static) {
-        return;
-    }
-
-    vec3 acceleration = (1.0 / mass) * force_accumulator;
-    velocity = velocity + dt * acceleration;
-    velocity = 0.98 * velocity;
-    position = position + dt * velocity;
+void RigidBody::set_inertia_tensor(const mat3 &inertia_tensor) {
+    store->inertia_tensors[id] = inertia_tensor;
+    store->inv_inertia_tensors[id] = store->inertia_tensors[id].inverse();
+    update_inertia_tensor_world();
+}
 
-    vec3 angular_acceleration = inertia_tensor.inverse() * torque_accumulator;
-    angular_velocity = angular_velocity + dt * angular_acceleration;
-    angular_velocity = 0.98 * angular_velocity;
-    orientation = quat(angular_velocity, dt) * orientation;
+/*
+ * Rotates the body space inverse inertia into world space, R * I^-1 * R^T. The engine does
+ * this for every awake body each step, call it when the orientation is changed from
+ * outside the engine.
+ */
+void RigidBody::update_inertia_tensor_world() {
+    mat3 rotation = orientation().get_rotation();
+    store->inv_inertia_tensors_world[id] = rotation * store->inv_inertia_tensors[id] * rotation.transpose();
 }
 
 void RigidBody::reset_forces() {
-    force_accumulator = vec3(0.0, 0.0, 0.0);
-    torque_accumulator = vec3(0.0, 0.0, 0.0);
+    force_accumulator() = vec3(0.0, 0.0, 0.0);
+    torque_accumulator() = vec3(0.0, 0.0, 0.0);
+}
+
+/*
+ * The rest of the body's island is woken by the engine at the start of the next step.
+ */
+void RigidBody::wake() {
+    store->sleeping_flags[id] = false;
+    sleep_time() = 0.0;
+}
+
+bool RigidBody::is_awake() {
+    return store->is_awake(id);
 }
 
 void RigidBody::apply_impulse(const vec3 &impulse) {
-    if (is_static) {
+    if (is_static()) {
         return;
     }
 
-    velocity = velocity + impulse;
+    wake();
+
+    velocity() = velocity() + impulse;
 }
 
 void RigidBody::apply_rotational_impulse(const vec3 &point, const vec3 &impulse) {
-    if (is_static) {
+    if (is_static()) {
         return;
     }
 
-    vec3 torque = vec3::cross(point - position, impulse);
-    vec3 angular_acceleration = inertia_tensor.inverse() * torque;
-    angular_velocity = angular_velocity + angular_acceleration;
+    wake();
+
+    vec3 torque = vec3::cross(point - position(), impulse);
+    vec3 angular_acceleration = get_inv_inertia_tensor() * torque;
+    angular_velocity() = angular_velocity() + angular_acceleration;
 }
 
 
-mat4 RigidBody::create_box_inertia_tensor(float mass, const vec3 &half_lengths) {
-    return mat4(
-            (1.0 / 12.0) * mass * (half_lengths.x + half_lengths.y), 0.0, 0.0, 0.0,
-            0.0, (1.0 / 12.0) * mass * (half_lengths.y + half_lengths.z), 0.0, 0.0,
-            0.0, 0.0, (1.0 / 12.0) * mass * (half_lengths.z + half_lengths.x), 0.0,
-            0.0, 0.0, 0.0, 1.0
+/*
+ * Solid cuboid, I = m / 12 * (h^2 + d^2) about each axis with h and d the full side lengths.
+ */
+mat3 RigidBody::create_box_inertia_tensor(float mass, const vec3 &half_lengths) {
+    float x2 = 4.0 * half_lengths.x * half_lengths.x;
+    float y2 = 4.0 * half_lengths.y * half_lengths.y;
+    float z2 = 4.0 * half_lengths.z * half_lengths.z;
+
+    return mat3(
+            (1.0 / 12.0) * mass * (y2 + z2), 0.0, 0.0,
+            0.0, (1.0 / 12.0) * mass * (x2 + z2), 0.0,
+            0.0, 0.0, (1.0 / 12.0) * mass * (x2 + y2)
             );
 }
 
-mat4 RigidBody::create_sphere_inertia_tensor(float mass, float radius) {
-    return mat4(
-            (2.0 / 5.0) * mass * radius * radius, 0.0, 0.0, 0.0,
-            0.0, (2.0 / 5.0) * mass * radius * radius, 0.0, 0.0,
-            0.0, 0.0, (2.0 / 5.0) * mass * radius * radius, 0.0,
-            0.0, 0.0, 0.0, 1.0
+mat3 RigidBody::create_sphere_inertia_tensor(float mass, float radius) {
+    return mat3(
+            (2.0 / 5.0) * mass * radius * radius, 0.0, 0.0,
+            0.0, (2.0 / 5.0) * mass * radius * radius, 0.0,
+            0.0, 0.0, (2.0 / 5.0) * mass * radius * radius
             );
 }
@@ -1,34 +1,96 @@
 #pragma once
 
+#include <vector>
+
 #include "maths.h"
 
-class RigidBody {
+#define VELOCITY_DAMPING 0.98
+
+/*
+ * Every rigid body in the world, one array per field indexed by body id. The per-step
+ * passes sweep the arrays from front to back instead of chasing collider pointers.
+ * inv_masses is refreshed from masses and static_flags by update_inv_masses. The ids of
+ * freed bodies are reused by the engine, freed bodies are static so every pass skips them.
+ */
+class RigidBodyStore {
     public:
-        float mass;
-        mat4 inertia_tensor;
+        std::vector<vec3> positions;
+        std::vector<quat> orientations;
+        std::vector<vec3> velocities;
+        std::vector<vec3> angular_velocities;
+
+        std::vector<float> masses;
+        std::vector<float> inv_masses;
+        std::vector<mat3> inertia_tensors;
+        std::vector<mat3> inv_inertia_tensors;
+        std::vector<mat3> inv_inertia_tensors_world;
+
+        std::vector<vec3> force_accumulators;
+        std::vector<vec3> torque_accumulators;
+
+        std::vector<float> restitutions;
+        std::vector<float> frictions;
 
-        vec3 position;
-        quat orientation;
-        vec3 velocity;
-        vec3 angular_velocity;
+        std::vector<unsigned char> static_flags;
+        std::vector<unsigned char> sleeping_flags;
+        std::vector<unsigned char> continuous_flags;
+        std::vector<float> sleep_times;
 
-        vec3 force_accumulator;
-        vec3 torque_accumulator;
+        int create_body();
+        void reset_body(int body_id);
+        void free_body(int body_id);
+        int size();
+        bool is_awake(int body_id);
 
-        float restitution;
-        float friction;
+        void update_inv_masses();
+        void apply_gravity(const vec3 &gravity);
+        void update_inertia_tensors_world();
+        void integrate(float dt);
+        void integrate_velocities(const int *body_ids, int num_bodies, float dt, float damping);
+        void integrate_positions(const int *body_ids, int num_bodies, float dt);
+};
 
-        bool is_static;
+/*
+ * Handle to one body in a RigidBodyStore. Copying it copies the handle, not the body.
+ */
+class RigidBody {
+    public:
+        RigidBodyStore *store;
+        int id;
 
         RigidBody();
+        RigidBody(RigidBodyStore *store, int id);
+
+        vec3 &position();
+        quat &orientation();
+        vec3 &velocity();
+        vec3 &angular_velocity();
+        float &mass();
+        float &restitution();
+        float &friction();
+        float &sleep_time();
+        vec3 &force_accumulator();
+        vec3 &torque_accumulator();
+
+        bool is_static();
+        void set_static(bool is_static);
+        bool is_sleeping();
+        void sleep();
+        bool is_continuous();
+        void set_continuous(bool is_continuous);
+
+        rigid_transform get_transform();
         float get_inv_mass();
-        mat4 get_inv_inertia_tensor();
+        mat3 get_inv_inertia_tensor();
+        void set_inertia_tensor(const mat3 &inertia_tensor);
+        void update_inertia_tensor_world();
         void apply_impulse(const vec3 &impulse);
         void apply_rotational_impulse(const vec3 &point, const vec3 &impulse);
         void add_force_at_point(const vec3 &force, const vec3 &point);
         void reset_forces();
-        void update(float dt);
+        void wake();
+        bool is_awake();
 
-        static mat4 create_box_inertia_tensor(float mass, const vec3 &half_lengths);
-        static mat4 create_sphere_inertia_tensor(float mass, float radius);
+        static mat3 create_box_inertia_tensor(float mass, const vec3 &half_lengths);
+        static mat3 create_sphere_inertia_tensor(float mass, float radius);
 };
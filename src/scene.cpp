@@ -5,10 +5,6 @@ Instance::Instance() {
     draw_outline = false;
 }
 
-Transform::Transform() {
-    scale = vec3(1.0, 1.0, 1.0);
-}
-
 Scene::Scene() {
 }
 
@@ -8,10 +8,10 @@
 
 #include "tiny_obj_loader.h"
 #include "maths.h"
+#include "transform.h"
 #include "texture.h"
 
 struct Material;
-struct Transform;
 
 struct Mesh {
     std::string name;
@@ -60,14 +60,6 @@ struct Instance {
     Instance();
 };
 
-struct Transform {
-    vec3 scale;
-    vec3 translation;
-    quat orientation;
-
-    Transform();
-};
-
 class Scene {
     public:
         Camera camera;
@@ -0,0 +1,188 @@
+#include "thread_pool.h"
+
+/*
+ * Queue 0 belongs to whichever thread calls parallel_for, the workers own the rest.
+ */
+static thread_local int thread_queue_index = 0;
+
+TaskQueue::TaskQueue() {
+    front = 0;
+}
+
+ThreadPool::ThreadPool() {
+    num_queued_tasks = 0;
+    next_queue = 0;
+    is_stopping = false;
+    start(1);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::start(int num_threads) {
+    is_stopping = false;
+
+    for (int i = 0; i < num_threads; i++) {
+        queues.push_back(new TaskQueue());
+    }
+
+    for (int i = 1; i < num_threads; i++) {
+        threads.push_back(std::thread(&ThreadPool::worker_main, this, i));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        is_stopping = true;
+    }
+    sleep_condition.notify_all();
+
+    for (int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    threads.clear();
+
+    for (int i = 0; i < queues.size(); i++) {
+        delete queues[i];
+    }
+    queues.clear();
+}
+
+void ThreadPool::set_num_threads(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    if (num_threads == get_num_threads()) {
+        return;
+    }
+
+    stop();
+    start(num_threads);
+}
+
+int ThreadPool::get_num_threads() {
+    return queues.size();
+}
+
+bool ThreadPool::pop_task(int queue_index, Task *task) {
+    TaskQueue *queue = queues[queue_index];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+
+    if (queue->front == queue->tasks.size()) {
+        return false;
+    }
+
+    *task = queue->tasks.back();
+    queue->tasks.pop_back();
+    if (queue->front == queue->tasks.size()) {
+        queue->tasks.clear();
+        queue->front = 0;
+    }
+    return true;
+}
+
+bool ThreadPool::steal_task(int queue_index, Task *task) {
+    int num_queues = queues.size();
+
+    for (int i = 1; i < num_queues; i++) {
+        TaskQueue *queue = queues[(queue_index + i) % num_queues];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+
+        if (queue->front < queue->tasks.size()) {
+            *task = queue->tasks[queue->front++];
+            if (queue->front == queue->tasks.size()) {
+                queue->tasks.clear();
+                queue->front = 0;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::run_one_task(int queue_index) {
+    Task task;
+
+    if (!pop_task(queue_index, &task) && !steal_task(queue_index, &task)) {
+        return false;
+    }
+
+    num_queued_tasks--;
+    task.function(task.data, task.begin, task.end);
+    (*task.pending)--;
+    return true;
+}
+
+void ThreadPool::worker_main(int queue_index) {
+    thread_queue_index = queue_index;
+
+    while (true) {
+        if (run_one_task(queue_index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_condition.wait(lock, [this] { return is_stopping || num_queued_tasks > 0; });
+
+        if (is_stopping) {
+            return;
+        }
+    }
+}
+
+/*
+ * Calls function(data, begin, end) over [0, count) in chunks of grain_size and returns when
+ * every chunk is done. Chunks may run on any thread in any order, so the function must
+ * only write to state owned by its own range. It is fine to call this from inside a task.
+ */
+void ThreadPool::parallel_for(int count, int grain_size, TaskFunction function, void *data) {
+    if (count <= 0) {
+        return;
+    }
+
+    if (grain_size < 1) {
+        grain_size = 1;
+    }
+
+    if (queues.size() == 1 || count <= grain_size) {
+        function(data, 0, count);
+        return;
+    }
+
+    std::atomic<int> pending;
+    pending = (count + grain_size - 1) / grain_size;
+
+    int num_queues = queues.size();
+    int queue_index = next_queue++;
+
+    for (int begin = 0; begin < count; begin += grain_size) {
+        Task task;
+        task.function = function;
+        task.data = data;
+        task.begin = begin;
+        task.end = begin + grain_size < count ? begin + grain_size : count;
+        task.pending = &pending;
+
+        TaskQueue *queue = queues[queue_index++ % num_queues];
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->tasks.push_back(task);
+        }
+        num_queued_tasks++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    sleep_condition.notify_all();
+
+    while (pending > 0) {
+        if (!run_one_task(thread_queue_index)) {
+            std::this_thread::yield();
+        }
+    }
+}
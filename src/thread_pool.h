@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*TaskFunction)(void *data, int begin, int end);
+
+struct Task {
+    TaskFunction function;
+    void *data;
+    int begin, end;
+    std::atomic<int> *pending;
+};
+
+/*
+ * Tasks [front, tasks.size()) are queued. The vector is only cleared once the queue runs
+ * dry, so it keeps its capacity and queueing tasks does not allocate after the first steps.
+ */
+struct TaskQueue {
+    std::mutex mutex;
+    std::vector<Task> tasks;
+    int front;
+
+    TaskQueue();
+};
+
+/*
+ * Fixed set of worker threads, each with its own task queue. A thread works from the back
+ * of its own queue and steals from the front of the others when it runs dry. The thread
+ * that calls parallel_for works on the tasks too, so a pool with one thread runs
+ * everything inline.
+ */
+class ThreadPool {
+    private:
+        std::vector<std::thread> threads;
+        std::vector<TaskQueue*> queues;
+        std::atomic<int> num_queued_tasks;
+        std::atomic<int> next_queue;
+        std::mutex sleep_mutex;
+        std::condition_variable sleep_condition;
+        bool is_stopping;
+
+        void worker_main(int queue_index);
+        bool pop_task(int queue_index, Task *task);
+        bool steal_task(int queue_index, Task *task);
+        bool run_one_task(int queue_index);
+        void start(int num_threads);
+        void stop();
+
+    public:
+        ThreadPool();
+        ~ThreadPool();
+
+        void set_num_threads(int num_threads);
+        int get_num_threads();
+        void parallel_for(int count, int grain_size, TaskFunction function, void *data);
+};
@@ -0,0 +1,5 @@
+#include "transform.h"
+
+Transform::Transform() {
+    scale = vec3(1.0, 1.0, 1.0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "maths.h"
+
+/*
+ * Where an instance is drawn. The physics engine writes the transforms of its colliders
+ * but does not need anything else from the scene.
+ */
+struct Transform {
+    vec3 scale;
+    vec3 translation;
+    quat orientation;
+
+    Transform();
+};
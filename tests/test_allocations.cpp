@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include "physics_engine.h"
+
+/*
+ * Checks that once a scene has warmed up, update allocates nothing, nor do queries or
+ * colliders coming and going. Global operator new and delete are replaced with versions
+ * that count every call, from any thread.
+ */
+
+static std::atomic<long> num_allocations(0);
+
+void *operator new(size_t size) {
+    num_allocations++;
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+    free(p);
+}
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+static void add_box(PhysicsEngine *engine, std::vector<Transform> *transforms, const vec3 &position,
+        const quat &orientation) {
+    Collider *collider = engine->get_collider(engine->add_cube_collider(transforms->size(), vec3(0.5, 0.5, 0.5)));
+    collider->body.position() = position;
+    collider->body.orientation() = orientation;
+    collider->body.friction() = 0.3;
+    collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.5, 0.5, 0.5)));
+    transforms->push_back(Transform());
+}
+
+static void add_sphere(PhysicsEngine *engine, std::vector<Transform> *transforms, const vec3 &position) {
+    Collider *collider = engine->get_collider(engine->add_sphere_collider(transforms->size(), 0.4));
+    collider->body.position() = position;
+    collider->body.friction() = 0.3;
+    collider->body.set_inertia_tensor(RigidBody::create_sphere_inertia_tensor(1.0, 0.4));
+    transforms->push_back(Transform());
+}
+
+/*
+ * A pyramid of boxes with a few spheres on top, so every kernel, the solver, the contact
+ * cache and the islands all run.
+ */
+static void build_scene(PhysicsEngine *engine, std::vector<Transform> *transforms) {
+    transforms->reserve(256);
+
+    Collider *ground = engine->get_collider(engine->add_plane_collider(transforms->size()));
+    ground->body.set_static(true);
+    ground->body.friction() = 0.3;
+    transforms->push_back(Transform());
+
+    for (int row = 0; row < 8; row++) {
+        for (int i = 0; i < 8 - row; i++) {
+            add_box(engine, transforms, vec3(i * 1.0 + row * 0.5, 0.5 + row * 1.0, 0.0), quat());
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        add_sphere(engine, transforms, vec3(1.0 + i * 1.5, 10.0, 0.0));
+    }
+}
+
+/*
+ * Steps the scene warmup_steps times and then counts the allocations of timed_steps more.
+ */
+static long count_step_allocations(int num_threads, int substeps, bool speculative_contacts, bool fixed_steps) {
+    std::vector<Transform> transforms;
+    PhysicsEngine engine;
+    build_scene(&engine, &transforms);
+    engine.transforms = &transforms;
+    engine.allow_sleeping = false;
+    engine.substeps = substeps;
+    engine.speculative_contacts = speculative_contacts;
+    engine.set_num_threads(num_threads);
+
+    int warmup_steps = 300;
+    int timed_steps = 200;
+
+    for (int i = 0; i < warmup_steps; i++) {
+        if (fixed_steps) {
+            engine.step_for(1.0 / 60.0);
+        }
+        else {
+            engine.update(1.0 / 60.0);
+        }
+    }
+
+    long start = num_allocations;
+
+    for (int i = 0; i < timed_steps; i++) {
+        if (fixed_steps) {
+            engine.step_for(1.0 / 60.0);
+        }
+        else {
+            engine.update(1.0 / 60.0);
+        }
+    }
+
+    long count = num_allocations - start;
+    if (count != 0) {
+        printf("  %ld allocations over %d steps\n", count, timed_steps);
+    }
+    return count;
+}
+
+/*
+ * Removes the oldest box and drops a new one in its place before every step, reusing its
+ * transform. Once the pools, collider slots and broadphase have grown to fit, neither the
+ * removal, the add nor the step allocates.
+ */
+static long count_churn_allocations() {
+    std::vector<Transform> transforms;
+    PhysicsEngine engine;
+    build_scene(&engine, &transforms);
+    engine.transforms = &transforms;
+
+    std::vector<ColliderHandle> handles;
+    for (int i = 0; i < 32; i++) {
+        handles.push_back(engine.add_cube_collider(transforms.size(), vec3(0.5, 0.5, 0.5)));
+        engine.get_collider(handles[i])->body.position() = vec3(20.0 + (i % 8) * 1.2, 1.0, (i / 8) * 1.2);
+        transforms.push_back(Transform());
+    }
+
+    int warmup_steps = 300;
+    int timed_steps = 200;
+    long start = 0;
+
+    for (int i = 0; i < warmup_steps + timed_steps; i++) {
+        if (i == warmup_steps) {
+            start = num_allocations;
+        }
+
+        int slot = i % handles.size();
+        Collider *old_box = engine.get_collider(handles[slot]);
+        int transform_id = old_box->transform_id;
+        vec3 position = old_box->body.position();
+        engine.remove_collider(handles[slot]);
+
+        handles[slot] = engine.add_cube_collider(transform_id, vec3(0.5, 0.5, 0.5));
+        Collider *new_box = engine.get_collider(handles[slot]);
+        new_box->body.position() = vec3(position.x, 1.0, position.z);
+        new_box->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.5, 0.5, 0.5)));
+
+        engine.update(1.0 / 60.0);
+    }
+
+    long count = num_allocations - start;
+    if (count != 0) {
+        printf("  %ld allocations over %d steps of churn\n", count, timed_steps);
+    }
+    return count;
+}
+
+#define NUM_QUERY_RAYS 64
+
+/*
+ * Casts batches of rays down into the settled scene. Once the first batch has grown the
+ * calling thread's query scratch, later batches allocate nothing.
+ */
+static long count_raycast_allocations() {
+    std::vector<Transform> transforms;
+    PhysicsEngine engine;
+    build_scene(&engine, &transforms);
+    engine.transforms = &transforms;
+
+    for (int i = 0; i < 60; i++) {
+        engine.update(1.0 / 60.0);
+    }
+
+    ray rays[NUM_QUERY_RAYS];
+    RaycastHit hits[NUM_QUERY_RAYS];
+    for (int i = 0; i < NUM_QUERY_RAYS; i++) {
+        rays[i].origin = vec3(-1.0 + i * 0.15, 12.0, 0.1);
+        rays[i].direction = vec3(0.0, -1.0, 0.0);
+    }
+
+    engine.raycast_batch(rays, NUM_QUERY_RAYS, hits);
+
+    int num_queries = 100;
+    long start = num_allocations;
+
+    for (int i = 0; i < num_queries; i++) {
+        engine.raycast_batch(rays, NUM_QUERY_RAYS, hits);
+        engine.raycast_batch(rays, NUM_QUERY_RAYS, hits, RAYCAST_ANY);
+
+        float t;
+        engine.raycast(rays[i % NUM_QUERY_RAYS], &t);
+    }
+
+    long count = num_allocations - start;
+    if (count != 0) {
+        printf("  %ld allocations over %d rounds of raycasts\n", count, num_queries);
+    }
+    return count;
+}
+
+/*
+ * Sweeps and overlaps at ten spots over the settled scene, with a hit list that has
+ * already grown to fit. Like raycasts they allocate nothing once a round of every spot
+ * has grown the calling thread's scratch.
+ */
+static long count_shape_query_allocations() {
+    std::vector<Transform> transforms;
+    PhysicsEngine engine;
+    build_scene(&engine, &transforms);
+    engine.transforms = &transforms;
+
+    for (int i = 0; i < 60; i++) {
+        engine.update(1.0 / 60.0);
+    }
+
+    std::vector<ShapeHit> hits;
+    hits.reserve(64);
+    ShapeHit hit;
+    quat turned = quat(vec3(0.0, 1.0, 0.0), 0.3);
+
+    int warmup_queries = 10;
+    int num_queries = 100;
+    long start = 0;
+
+    for (int i = 0; i < warmup_queries + num_queries; i++) {
+        if (i == warmup_queries) {
+            start = num_allocations;
+        }
+
+        vec3 center = vec3(-1.0 + (i % 10) * 1.0, 12.0, 0.0);
+        engine.sphere_sweep(center, 0.3, vec3(0.0, -12.0, 0.0), &hit);
+        engine.box_sweep(center, vec3(0.3, 0.3, 0.3), turned, vec3(0.0, -12.0, 0.0), &hit);
+
+        hits.clear();
+        engine.overlap_sphere(vec3(center.x, 1.0, 0.0), 0.8, &hits);
+        engine.overlap_box(vec3(center.x, 2.0, 0.0), vec3(0.8, 0.8, 0.8), turned, &hits);
+    }
+
+    long count = num_allocations - start;
+    if (count != 0) {
+        printf("  %ld allocations over %d rounds of shape queries\n", count, num_queries);
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    check(count_step_allocations(1, 1, false, false) == 0, "update allocates nothing");
+    check(count_step_allocations(4, 1, false, false) == 0, "update allocates nothing on four threads");
+    check(count_step_allocations(1, 4, false, false) == 0, "update allocates nothing with substeps");
+    check(count_step_allocations(1, 1, true, false) == 0, "update allocates nothing with speculative contacts");
+    check(count_step_allocations(1, 1, false, true) == 0, "step_for allocates nothing");
+    check(count_churn_allocations() == 0, "removing and adding colliders allocates nothing");
+    check(count_raycast_allocations() == 0, "raycasts allocate nothing");
+    check(count_shape_query_allocations() == 0, "sweeps and overlaps allocate nothing");
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_allocations passed\n");
+    return 0;
+}
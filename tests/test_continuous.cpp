@@ -0,0 +1,153 @@
+#include <stdio.h>
+
+#include "physics_engine.h"
+
+/*
+ * Fires fast bodies at a thin slab and a thin wall and checks that continuous bodies never
+ * pass through either in a step, while the same bodies left discrete do.
+ */
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+struct TunnelResult {
+    int num_tunnels;
+    int num_impacts;
+};
+
+/*
+ * Whether a body moving from a to b this step crossed the plane x[axis] = offset within
+ * the square of half width extent around center.
+ */
+static bool crossed(const vec3 &a, const vec3 &b, int axis, float offset, const vec3 &center, float extent) {
+    if ((a[axis] - offset) * (b[axis] - offset) >= 0.0) {
+        return false;
+    }
+
+    vec3 middle = 0.5 * (a + b);
+    for (int i = 0; i < 3; i++) {
+        if (i != axis && ABS(middle[i] - center[i]) > extent) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static Collider *add_static_box(PhysicsEngine *engine, const vec3 &position, const vec3 &half_lengths) {
+    Collider *collider = engine->get_collider(engine->add_cube_collider(0, half_lengths));
+    collider->body.position() = position;
+    collider->body.set_static(true);
+    return collider;
+}
+
+/*
+ * A 5 cm slab at y = 3 and a 4 cm wall at x = 5. A box falls through the slab at 150 m/s, a
+ * sphere at 300 m/s, and another box flies into the wall at 200 m/s.
+ */
+static TunnelResult run_tunnel_scene(bool is_continuous, int substeps) {
+    std::vector<Transform> transforms(1);
+    PhysicsEngine engine;
+    engine.transforms = &transforms;
+    engine.substeps = substeps;
+
+    engine.get_collider(engine.add_plane_collider(0))->body.set_static(true);
+    add_static_box(&engine, vec3(0.0, 3.0, 0.0), vec3(3.0, 0.025, 3.0));
+    add_static_box(&engine, vec3(5.0, 3.0, 0.0), vec3(0.02, 3.0, 3.0));
+
+    Collider *bodies[3];
+    bodies[0] = engine.get_collider(engine.add_cube_collider(0, vec3(0.2, 0.2, 0.2)));
+    bodies[0]->body.position() = vec3(-1.0, 10.0, 0.0);
+    bodies[0]->body.velocity() = vec3(0.0, -150.0, 0.0);
+    bodies[0]->body.angular_velocity() = vec3(3.0, 20.0, 1.0);
+    bodies[0]->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.2, 0.2, 0.2)));
+
+    bodies[1] = engine.get_collider(engine.add_sphere_collider(0, 0.1));
+    bodies[1]->body.position() = vec3(1.0, 10.0, 0.0);
+    bodies[1]->body.velocity() = vec3(0.0, -300.0, 0.0);
+    bodies[1]->body.set_inertia_tensor(RigidBody::create_sphere_inertia_tensor(1.0, 0.1));
+
+    bodies[2] = engine.get_collider(engine.add_cube_collider(0, vec3(0.2, 0.2, 0.2)));
+    bodies[2]->body.position() = vec3(-20.0, 3.3, 0.5);
+    bodies[2]->body.velocity() = vec3(200.0, -2.0, 0.0);
+    bodies[2]->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.2, 0.2, 0.2)));
+
+    for (int i = 0; i < 3; i++) {
+        bodies[i]->body.restitution() = 0.2;
+        bodies[i]->body.friction() = 0.3;
+        bodies[i]->body.set_continuous(is_continuous);
+    }
+
+    TunnelResult result;
+    result.num_tunnels = 0;
+    result.num_impacts = 0;
+
+    for (int step = 0; step < 120; step++) {
+        vec3 start[3];
+        for (int i = 0; i < 3; i++) {
+            start[i] = bodies[i]->body.position();
+        }
+
+        engine.update(1.0 / 60.0);
+        result.num_impacts += engine.stats.num_continuous_impacts;
+
+        for (int i = 0; i < 3; i++) {
+            vec3 end = bodies[i]->body.position();
+            result.num_tunnels += crossed(start[i], end, 1, 3.0, vec3(0.0, 3.0, 0.0), 3.0);
+            result.num_tunnels += crossed(start[i], end, 0, 5.0, vec3(5.0, 3.0, 0.0), 3.0);
+        }
+    }
+
+    return result;
+}
+
+/*
+ * A slow continuous body moves less than its inner radius a step, so it is never swept.
+ */
+static void test_slow_body() {
+    std::vector<Transform> transforms(1);
+    PhysicsEngine engine;
+    engine.transforms = &transforms;
+
+    engine.get_collider(engine.add_plane_collider(0))->body.set_static(true);
+    Collider *box = engine.get_collider(engine.add_cube_collider(0, vec3(0.5, 0.5, 0.5)));
+    box->body.position() = vec3(0.0, 2.0, 0.0);
+    box->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.5, 0.5, 0.5)));
+    box->body.set_continuous(true);
+
+    int num_impacts = 0;
+    for (int step = 0; step < 120; step++) {
+        engine.update(1.0 / 60.0);
+        num_impacts += engine.stats.num_continuous_impacts;
+    }
+
+    check(num_impacts == 0, "a slow continuous body is never swept");
+    check(ABS(box->body.position().y - 0.5) < 0.05, "a slow continuous body comes to rest on the ground");
+}
+
+int main(int argc, char **argv) {
+    TunnelResult discrete = run_tunnel_scene(false, 1);
+    check(discrete.num_tunnels > 0, "fast discrete bodies pass through thin bodies");
+
+    TunnelResult continuous = run_tunnel_scene(true, 1);
+    check(continuous.num_tunnels == 0, "fast continuous bodies never pass through thin bodies");
+    check(continuous.num_impacts > 0, "fast continuous bodies are stepped back to their impacts");
+
+    TunnelResult substepped = run_tunnel_scene(true, 4);
+    check(substepped.num_tunnels == 0, "fast continuous bodies never pass through thin bodies with substeps");
+
+    test_slow_body();
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_continuous passed\n");
+    return 0;
+}
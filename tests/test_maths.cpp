@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "maths.h"
+
+/*
+ * Checks that the SSE versions of the maths operators give bit for bit the same results
+ * as the scalar ones, on random inputs and on the edge cases of the ray slab test.
+ */
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+static float random_float(float scale) {
+    return scale * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+static vec3 random_vec3(float scale) {
+    return vec3(random_float(scale), random_float(scale), random_float(scale));
+}
+
+static mat4 random_mat4(float scale) {
+    mat4 m;
+    for (int i = 0; i < 16; i++) {
+        m.m[i] = random_float(scale);
+    }
+    return m;
+}
+
+static bool same_bits(const void *a, const void *b, int size) {
+    return memcmp(a, b, size) == 0;
+}
+
+#ifdef MATHS_SSE
+
+static void test_cross() {
+    bool same = true;
+
+    for (int i = 0; i < 100000; i++) {
+        float scale = i % 3 == 0 ? 1.0e-3 : (i % 3 == 1 ? 1.0 : 1.0e4);
+        vec3 u = random_vec3(scale);
+        vec3 v = random_vec3(1.0);
+        vec3 c1 = cross_scalar(u, v);
+        vec3 c2 = cross_sse(u, v);
+        same = same && same_bits(&c1, &c2, sizeof(vec3));
+    }
+
+    check(same, "cross_sse matches cross_scalar");
+}
+
+static void test_mat4() {
+    bool same_transpose = true;
+    bool same_product = true;
+
+    for (int i = 0; i < 100000; i++) {
+        mat4 a = random_mat4(i % 2 == 0 ? 1.0 : 100.0);
+        mat4 b = random_mat4(1.0);
+
+        mat4 t1 = transpose_scalar(a);
+        mat4 t2 = transpose_sse(a);
+        same_transpose = same_transpose && same_bits(t1.m, t2.m, sizeof(t1.m));
+
+        mat4 p1 = multiply_scalar(a, b);
+        mat4 p2 = multiply_sse(a, b);
+        same_product = same_product && same_bits(p1.m, p2.m, sizeof(p1.m));
+    }
+
+    check(same_transpose, "transpose_sse matches transpose_scalar");
+    check(same_product, "multiply_sse matches multiply_scalar");
+}
+
+/*
+ * Rays from around a unit box, some with zero direction components and some starting in
+ * the planes of its faces, where the infinite inverse directions and NaNs come in.
+ */
+static void test_ray_packets() {
+    bool same = true;
+    aabb box(vec3(-1.0, -1.0, -1.0), vec3(1.0, 1.0, 1.0));
+    float edges[] = { -1.0, 0.0, 1.0 };
+
+    for (int i = 0; i < 20000; i++) {
+        ray rays[RAY_PACKET_SIZE];
+        int num_rays = 1 + i % RAY_PACKET_SIZE;
+
+        for (int j = 0; j < num_rays; j++) {
+            rays[j].origin = random_vec3(3.0);
+            rays[j].direction = random_vec3(1.0);
+
+            for (int k = 0; k < 3; k++) {
+                if (rand() % 5 == 0) {
+                    rays[j].direction[k] = 0.0;
+                }
+                if (rand() % 5 == 0) {
+                    rays[j].origin[k] = edges[rand() % 3];
+                }
+            }
+        }
+
+        ray_packet packet(rays, num_rays, i % 5 == 0 ? 1.0 : 100.0);
+        same = same && intersect_aabb_scalar(packet, box) == intersect_aabb_sse(packet, box);
+    }
+
+    check(same, "intersect_aabb_sse matches intersect_aabb_scalar");
+}
+
+#endif
+
+int main(int argc, char **argv) {
+#ifdef MATHS_SSE
+    test_cross();
+    test_mat4();
+    test_ray_packets();
+#else
+    printf("test_maths built without SSE, nothing to compare\n");
+#endif
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_maths passed\n");
+    return 0;
+}
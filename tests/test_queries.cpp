@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <thread>
+
+#include "physics_engine.h"
+
+/*
+ * Checks the shape queries against scenes simple enough to work the answers out by hand:
+ * the fraction, normal and collider of sweeps that hit, sweeps that miss or start out
+ * touching, overlaps, removed colliders and queries run from several threads at once.
+ */
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+static bool near(float a, float b) {
+    return ABS(a - b) < 0.001;
+}
+
+static bool near(const vec3 &a, const vec3 &b) {
+    return near(a.x, b.x) && near(a.y, b.y) && near(a.z, b.z);
+}
+
+static bool same_handle(ColliderHandle a, ColliderHandle b) {
+    return a.id == b.id && a.generation == b.generation;
+}
+
+struct QueryScene {
+    PhysicsEngine engine;
+    std::vector<Transform> transforms;
+    ColliderHandle ground;
+    ColliderHandle box;
+};
+
+static ColliderHandle add_static_box(QueryScene *scene, const vec3 &position, const vec3 &half_lengths,
+        const quat &orientation) {
+    ColliderHandle handle = scene->engine.add_cube_collider(0, half_lengths);
+    Collider *collider = scene->engine.get_collider(handle);
+    collider->body.position() = position;
+    collider->body.orientation() = orientation;
+    collider->body.set_static(true);
+    return handle;
+}
+
+/*
+ * The ground plane y = 0 and a 2 x 2 x 2 box standing on it at x = 5.
+ */
+static void build_scene(QueryScene *scene) {
+    scene->transforms.resize(1);
+    scene->engine.transforms = &scene->transforms;
+
+    scene->ground = scene->engine.add_plane_collider(0);
+    scene->engine.get_collider(scene->ground)->body.set_static(true);
+    scene->box = add_static_box(scene, vec3(5.0, 1.0, 0.0), vec3(1.0, 1.0, 1.0), quat());
+    scene->engine.refit_broadphase();
+}
+
+static void test_sweeps() {
+    QueryScene scene;
+    build_scene(&scene);
+    PhysicsEngine *engine = &scene.engine;
+    ShapeHit hit;
+
+    bool is_hit = engine->sphere_sweep(vec3(0.0, 5.0, 0.0), 0.5, vec3(0.0, -10.0, 0.0), &hit);
+    check(is_hit, "sphere dropped onto the ground hits");
+    check(same_handle(hit.collider, scene.ground), "sphere dropped onto the ground hits the ground");
+    check(near(hit.fraction, 0.45), "sphere dropped onto the ground stops on it");
+    check(near(hit.normal, vec3(0.0, 1.0, 0.0)), "ground normal points up");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 1.0, 0.0), 0.5, vec3(10.0, 0.0, 0.0), &hit);
+    check(is_hit, "sphere swept into the box hits");
+    check(same_handle(hit.collider, scene.box), "sphere swept into the box hits the box");
+    check(near(hit.fraction, 0.35), "sphere swept into the box stops at its face");
+    check(near(hit.normal, vec3(-1.0, 0.0, 0.0)), "box normal points back at the sphere");
+
+    quat turned(vec3(0.0, 1.0, 0.0), 0.3);
+    is_hit = engine->box_sweep(vec3(0.0, 3.0, 0.0), vec3(0.5, 0.5, 0.5), turned, vec3(0.0, -5.0, 0.0), &hit);
+    check(is_hit, "box dropped onto the ground hits");
+    check(same_handle(hit.collider, scene.ground), "box dropped onto the ground hits the ground");
+    check(near(hit.fraction, 0.5), "box dropped onto the ground stops on it");
+    check(near(hit.normal, vec3(0.0, 1.0, 0.0)), "ground normal points up under the box");
+
+    is_hit = engine->box_sweep(vec3(5.0, 4.0, 0.0), vec3(0.5, 0.5, 0.5), quat(), vec3(0.0, -4.0, 0.0), &hit);
+    check(is_hit && same_handle(hit.collider, scene.box), "box dropped onto the box hits the box");
+    check(near(hit.fraction, 0.375), "box dropped onto the box stops on its top");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 5.0, 0.0), 0.5, vec3(0.0, 5.0, 0.0), &hit);
+    check(!is_hit, "sphere swept up into empty space misses");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 1.0, 5.0), 0.5, vec3(10.0, 0.0, 0.0), &hit);
+    check(!is_hit, "sphere swept past the box misses");
+}
+
+static void test_starting_in_contact() {
+    QueryScene scene;
+    build_scene(&scene);
+    PhysicsEngine *engine = &scene.engine;
+    ShapeHit hit;
+
+    bool is_hit = engine->sphere_sweep(vec3(0.0, 0.5, 0.0), 0.5, vec3(0.0, 1.0, 0.0), &hit);
+    check(!is_hit, "sphere resting on the ground lifts off without a hit");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 0.5, 0.0), 0.5, vec3(10.0, 0.0, 0.0), &hit);
+    check(is_hit, "sphere sliding along the ground hits the box");
+    check(same_handle(hit.collider, scene.box), "sphere sliding along the ground ignores the ground");
+    check(near(hit.fraction, 0.35), "sphere sliding along the ground stops at the box");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 0.5, 0.0), 0.5, vec3(0.0, -1.0, 0.0), &hit);
+    check(is_hit && same_handle(hit.collider, scene.ground), "sphere resting on the ground pushed down hits it");
+    check(near(hit.fraction, 0.0), "sphere resting on the ground pushed down stops at once");
+
+    is_hit = engine->box_sweep(vec3(3.5, 1.0, 0.0), vec3(0.5, 0.5, 0.5), quat(), vec3(-2.0, 1.0, 0.0), &hit);
+    check(!is_hit, "box touching the box moves away without a hit");
+}
+
+static void test_overlaps() {
+    QueryScene scene;
+    build_scene(&scene);
+    PhysicsEngine *engine = &scene.engine;
+    std::vector<ShapeHit> hits;
+
+    engine->overlap_sphere(vec3(5.2, 1.5, 0.1), 0.2, &hits);
+    check(hits.size() == 1, "sphere inside the box overlaps only the box");
+    if (hits.size() == 1) {
+        check(same_handle(hits[0].collider, scene.box), "sphere inside the box overlaps the box");
+        check(near(hits[0].normal, vec3(0.0, 1.0, 0.0)), "sphere inside the box is pushed out of the nearest face");
+        check(hits[0].fraction == 0.0, "overlaps have a fraction of zero");
+    }
+
+    hits.clear();
+    engine->overlap_box(vec3(3.8, 0.2, 0.0), vec3(0.3, 0.3, 0.3), quat(), &hits);
+    check(hits.size() == 2, "box in the corner overlaps the ground and the box");
+    for (int i = 0; i < hits.size(); i++) {
+        if (same_handle(hits[i].collider, scene.ground)) {
+            check(near(hits[i].normal, vec3(0.0, 1.0, 0.0)), "ground pushes the box up");
+        }
+        else {
+            check(same_handle(hits[i].collider, scene.box), "box in the corner overlaps the box");
+            check(near(hits[i].normal, vec3(-1.0, 0.0, 0.0)), "box pushes the box out of its side");
+        }
+    }
+
+    hits.clear();
+    engine->overlap_sphere(vec3(0.0, 3.0, 0.0), 0.5, &hits);
+    check(hits.size() == 0, "sphere in the air overlaps nothing");
+}
+
+/*
+ * Spheres inside boxes turned and moved away from the origin, where the trip into box
+ * space and back leaves the closest point a rounding error away from the center.
+ */
+static void test_overlaps_turned_box() {
+    QueryScene scene;
+    build_scene(&scene);
+    PhysicsEngine *engine = &scene.engine;
+    std::vector<ShapeHit> hits;
+
+    for (int i = 0; i < 16; i++) {
+        quat turned = quat(vec3(1.0, 2.0 - 0.3 * i, 3.0).normalize(), 0.4 * i + 0.3).normalize();
+        rigid_transform box_transform(turned, vec3(0.1 * i, 10.3, 0.7));
+        ColliderHandle box = add_static_box(&scene, box_transform.translation, vec3(1.0, 1.0, 1.0), turned);
+        engine->refit_broadphase();
+
+        hits.clear();
+        engine->overlap_sphere(box_transform.transform_point(vec3(0.6, 0.1, 0.05)), 0.2, &hits);
+        check(hits.size() == 1, "sphere inside the turned box overlaps only the box");
+        if (hits.size() == 1) {
+            check(same_handle(hits[0].collider, box), "sphere inside the turned box overlaps the box");
+            check(near(hits[0].normal, box_transform.transform_vector(vec3(1.0, 0.0, 0.0))),
+                    "sphere inside the turned box is pushed out of the nearest face");
+        }
+
+        engine->remove_collider(box);
+    }
+}
+
+/*
+ * Queries never report a removed collider, and a handle to it stays stale once another
+ * collider takes its slot.
+ */
+static void test_removed_colliders() {
+    QueryScene scene;
+    build_scene(&scene);
+    PhysicsEngine *engine = &scene.engine;
+    ShapeHit hit;
+
+    ColliderHandle wall = add_static_box(&scene, vec3(-5.0, 1.0, 0.0), vec3(0.5, 1.0, 1.0), quat());
+    engine->refit_broadphase();
+
+    bool is_hit = engine->sphere_sweep(vec3(0.0, 1.0, 0.0), 0.5, vec3(-10.0, 0.0, 0.0), &hit);
+    check(is_hit && same_handle(hit.collider, wall), "sphere swept at the wall hits it");
+
+    engine->remove_collider(wall);
+    is_hit = engine->sphere_sweep(vec3(0.0, 1.0, 0.0), 0.5, vec3(-10.0, 0.0, 0.0), &hit);
+    check(!is_hit, "sphere swept at the removed wall misses");
+
+    ColliderHandle new_wall = add_static_box(&scene, vec3(-5.0, 1.0, 0.0), vec3(0.5, 1.0, 1.0), quat());
+    engine->refit_broadphase();
+    check(new_wall.id == wall.id, "the new wall takes the removed wall's slot");
+    check(engine->get_collider(wall) == NULL, "the removed wall's handle stays stale");
+
+    is_hit = engine->sphere_sweep(vec3(0.0, 1.0, 0.0), 0.5, vec3(-10.0, 0.0, 0.0), &hit);
+    check(is_hit && same_handle(hit.collider, new_wall), "sphere swept at the new wall hits it");
+    check(!same_handle(hit.collider, wall), "the hit does not resolve to the removed wall");
+
+    std::vector<ShapeHit> hits;
+    engine->overlap_sphere(vec3(-5.0, 1.0, 0.0), 0.2, &hits);
+    check(hits.size() == 1 && same_handle(hits[0].collider, new_wall), "overlap finds only the new wall");
+}
+
+#define NUM_RANDOM_QUERIES 2000
+#define NUM_QUERY_THREADS 4
+
+struct QueryResult {
+    bool is_hit;
+    ShapeHit hit;
+    int num_overlaps;
+    ShapeHit first_overlap;
+};
+
+/*
+ * rand shares its state between threads, so each query draws from its own generator.
+ */
+static float random_float(unsigned int *state) {
+    *state = *state * 1664525 + 1013904223;
+    return (*state >> 8) / 16777216.0;
+}
+
+static void run_query(PhysicsEngine *engine, int i, QueryResult *result) {
+    unsigned int state = i;
+    float r[12];
+    for (int k = 0; k < 12; k++) {
+        r[k] = random_float(&state);
+    }
+
+    vec3 center(20.0 * r[0] - 10.0, 4.0 * r[1], 20.0 * r[2] - 10.0);
+    vec3 displacement(10.0 * r[3] - 5.0, 6.0 * r[4] - 4.0, 10.0 * r[5] - 5.0);
+    vec3 half_lengths(0.1 + r[6], 0.1 + r[7], 0.1 + r[8]);
+    quat orientation(vec3(r[9], 1.0, r[10]).normalize(), 3.0 * r[11]);
+
+    result->is_hit = false;
+    result->num_overlaps = 0;
+    std::vector<ShapeHit> hits;
+
+    if (i % 2 == 0) {
+        result->is_hit = engine->sphere_sweep(center, half_lengths.x, displacement, &result->hit);
+        engine->overlap_sphere(center, half_lengths.x, &hits);
+    }
+    else {
+        result->is_hit = engine->box_sweep(center, half_lengths, orientation, displacement, &result->hit);
+        engine->overlap_box(center, half_lengths, orientation, &hits);
+    }
+
+    result->num_overlaps = hits.size();
+    if (hits.size() > 0) {
+        result->first_overlap = hits[0];
+    }
+}
+
+static bool same_hit(const ShapeHit &a, const ShapeHit &b) {
+    return same_handle(a.collider, b.collider) && a.fraction == b.fraction && a.normal.x == b.normal.x
+        && a.normal.y == b.normal.y && a.normal.z == b.normal.z;
+}
+
+static bool same_result(const QueryResult &a, const QueryResult &b) {
+    if (a.is_hit != b.is_hit || a.num_overlaps != b.num_overlaps) {
+        return false;
+    }
+
+    return (!a.is_hit || same_hit(a.hit, b.hit)) && (a.num_overlaps == 0 || same_hit(a.first_overlap, b.first_overlap));
+}
+
+struct QueryThread {
+    PhysicsEngine *engine;
+    QueryResult *results;
+    int begin;
+};
+
+/*
+ * Runs every NUM_QUERY_THREADS-th query, so the threads interleave over the same colliders.
+ */
+static void query_thread(QueryThread *thread) {
+    for (int i = thread->begin; i < NUM_RANDOM_QUERIES; i += NUM_QUERY_THREADS) {
+        run_query(thread->engine, i, &thread->results[i]);
+    }
+}
+
+/*
+ * A field of boxes and spheres left to settle, then the same random queries run once on
+ * this thread and once spread over several.
+ */
+static void test_concurrent_queries() {
+    std::vector<Transform> transforms;
+    PhysicsEngine engine;
+    transforms.resize(1);
+    engine.transforms = &transforms;
+
+    engine.get_collider(engine.add_plane_collider(0))->body.set_static(true);
+    for (int i = 0; i < 200; i++) {
+        vec3 position((i % 14) * 1.5 - 10.0, 0.6 + (i / 100) * 1.5, ((i / 14) % 14) * 1.5 - 10.0);
+        Collider *collider;
+        if (i % 3 == 0) {
+            collider = engine.get_collider(engine.add_sphere_collider(0, 0.5));
+            collider->body.set_inertia_tensor(RigidBody::create_sphere_inertia_tensor(1.0, 0.5));
+        }
+        else {
+            collider = engine.get_collider(engine.add_cube_collider(0, vec3(0.5, 0.5, 0.5)));
+            collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.5, 0.5, 0.5)));
+        }
+        collider->body.position() = position;
+    }
+
+    for (int i = 0; i < 60; i++) {
+        engine.update(1.0 / 60.0);
+    }
+
+    std::vector<QueryResult> sequential(NUM_RANDOM_QUERIES);
+    std::vector<QueryResult> concurrent(NUM_RANDOM_QUERIES);
+    int num_hits = 0;
+
+    for (int i = 0; i < NUM_RANDOM_QUERIES; i++) {
+        run_query(&engine, i, &sequential[i]);
+        num_hits += sequential[i].is_hit;
+    }
+
+    std::vector<std::thread> threads;
+    QueryThread thread_data[NUM_QUERY_THREADS];
+    for (int t = 0; t < NUM_QUERY_THREADS; t++) {
+        thread_data[t].engine = &engine;
+        thread_data[t].results = concurrent.data();
+        thread_data[t].begin = t;
+        threads.push_back(std::thread(query_thread, &thread_data[t]));
+    }
+    for (int t = 0; t < NUM_QUERY_THREADS; t++) {
+        threads[t].join();
+    }
+
+    bool same = true;
+    for (int i = 0; i < NUM_RANDOM_QUERIES; i++) {
+        same = same && same_result(sequential[i], concurrent[i]);
+    }
+
+    check(num_hits > NUM_RANDOM_QUERIES / 4, "random sweeps hit something");
+    check(same, "queries from several threads match the same queries run in turn");
+}
+
+int main(int argc, char **argv) {
+    test_sweeps();
+    test_starting_in_contact();
+    test_overlaps();
+    test_overlaps_turned_box();
+    test_removed_colliders();
+    test_concurrent_queries();
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_queries passed\n");
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "physics_engine.h"
+
+/*
+ * Checks raycast_batch against testing every ray against every collider, with both
+ * broadphases, in closest and any hit mode and with a max_t. Some rays run parallel to the
+ * axes, where the packet slab test sees infinite inverse directions.
+ */
+
+#define NUM_RAYS 5000
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+static float random_float(float min, float max) {
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+/*
+ * Boxes and spheres scattered over a patch of ground, with rays from all around it.
+ */
+static void build_scene(PhysicsEngine *engine, std::vector<Transform> *transforms, std::vector<ray> *rays) {
+    srand(7);
+    transforms->resize(1);
+    engine->transforms = transforms;
+    engine->allow_sleeping = false;
+    engine->add_plane_collider(0);
+
+    for (int i = 0; i < 500; i++) {
+        ColliderHandle handle;
+        if (i % 3 == 0) {
+            handle = engine->add_sphere_collider(0, random_float(0.3, 0.8));
+        }
+        else {
+            handle = engine->add_cube_collider(0, vec3(random_float(0.2, 1.2), random_float(0.2, 1.2),
+                        random_float(0.2, 1.2)));
+        }
+
+        Collider *collider = engine->get_collider(handle);
+        collider->body.position() = vec3(random_float(-20.0, 20.0), random_float(1.0, 10.0), random_float(-20.0, 20.0));
+        collider->body.orientation() = quat(vec3(random_float(0.0, 1.0), 1.0, random_float(0.0, 1.0)).normalize(),
+                random_float(0.0, 6.0));
+        collider->body.set_static(true);
+    }
+
+    engine->refit_broadphase();
+
+    rays->resize(NUM_RAYS);
+    for (int i = 0; i < NUM_RAYS; i++) {
+        ray *r = &(*rays)[i];
+        r->origin = vec3(random_float(-25.0, 25.0), random_float(0.0, 15.0), random_float(-25.0, 25.0));
+        r->direction = vec3(random_float(-1.0, 1.0), random_float(-1.0, 1.0), random_float(-1.0, 1.0));
+
+        if (i % 7 == 0) {
+            r->direction.y = 0.0;
+        }
+        if (i % 11 == 0) {
+            r->direction = vec3(0.0, -1.0, 0.0);
+        }
+    }
+}
+
+/*
+ * The closest collider the ray hits up to max_t, -1 if none.
+ */
+static int brute_force_raycast(PhysicsEngine *engine, ray r, float max_t, float *t_out) {
+    int closest = -1;
+    *t_out = max_t;
+
+    for (int i = 0; i < engine->colliders.size(); i++) {
+        float t;
+        if (engine->colliders[i] != NULL && engine->colliders[i]->intersect(r, &t) && t <= *t_out) {
+            closest = i;
+            *t_out = t;
+        }
+    }
+
+    return closest;
+}
+
+static void test_broadphase(Broadphase *broadphase, const char *name) {
+    std::vector<Transform> transforms;
+    std::vector<ray> rays;
+    PhysicsEngine engine;
+    if (broadphase != NULL) {
+        engine.set_broadphase(broadphase);
+    }
+    build_scene(&engine, &transforms, &rays);
+
+    std::vector<RaycastHit> closest(NUM_RAYS);
+    std::vector<RaycastHit> any(NUM_RAYS);
+    std::vector<RaycastHit> limited(NUM_RAYS);
+    engine.raycast_batch(rays.data(), NUM_RAYS, closest.data());
+    engine.raycast_batch(rays.data(), NUM_RAYS, any.data(), RAYCAST_ANY);
+    engine.raycast_batch(rays.data(), NUM_RAYS, limited.data(), RAYCAST_CLOSEST, 5.0);
+
+    bool closest_ok = true;
+    bool any_ok = true;
+    bool limited_ok = true;
+    bool single_ok = true;
+    int num_hits = 0;
+    int num_limited_hits = 0;
+
+    for (int i = 0; i < NUM_RAYS; i++) {
+        float t;
+        int expected = brute_force_raycast(&engine, rays[i], FLT_MAX, &t);
+        num_hits += expected != -1;
+
+        if (expected == -1) {
+            closest_ok = closest_ok && closest[i].collider.id == -1;
+        }
+        else {
+            /*
+             * Another collider the ray enters at the same time will do as well.
+             */
+            float hit_t;
+            Collider *collider = engine.get_collider(closest[i].collider);
+            bool is_tie = collider != NULL && collider->intersect(rays[i], &hit_t) && ABS(hit_t - t) < 1.0e-4;
+            closest_ok = closest_ok && (closest[i].collider.id == expected || is_tie) && ABS(closest[i].t - t) < 1.0e-4;
+        }
+
+        if (any[i].collider.id == -1) {
+            any_ok = any_ok && expected == -1;
+        }
+        else {
+            float any_t;
+            Collider *collider = engine.get_collider(any[i].collider);
+            any_ok = any_ok && collider != NULL && collider->intersect(rays[i], &any_t) && ABS(any_t - any[i].t) < 1.0e-4;
+        }
+
+        float limited_t;
+        int limited_expected = brute_force_raycast(&engine, rays[i], 5.0, &limited_t);
+        num_limited_hits += limited_expected != -1;
+        if (limited_expected == -1) {
+            limited_ok = limited_ok && limited[i].collider.id == -1;
+        }
+        else {
+            limited_ok = limited_ok && limited[i].collider.id != -1 && ABS(limited[i].t - limited_t) < 1.0e-4;
+        }
+
+        if (i % 50 == 0) {
+            float single_t;
+            ColliderHandle single = engine.raycast(rays[i], &single_t);
+            single_ok = single_ok && single.id == closest[i].collider.id && single.generation == closest[i].collider.generation
+                && (single.id == -1 || ABS(single_t - closest[i].t) < 1.0e-4);
+        }
+    }
+
+    char message[128];
+    snprintf(message, sizeof(message), "%s: closest hits match brute force", name);
+    check(closest_ok, message);
+    snprintf(message, sizeof(message), "%s: any hits are real and found whenever there is one", name);
+    check(any_ok, message);
+    snprintf(message, sizeof(message), "%s: hits past max_t are left out", name);
+    check(limited_ok, message);
+    snprintf(message, sizeof(message), "%s: raycast matches raycast_batch", name);
+    check(single_ok, message);
+    snprintf(message, sizeof(message), "%s: some rays hit, some miss", name);
+    check(num_hits > NUM_RAYS / 10 && num_hits < NUM_RAYS && num_limited_hits > 0 && num_limited_hits < num_hits, message);
+}
+
+/*
+ * A removed collider is never hit, and the ray finds what is behind it instead.
+ */
+static void test_removed_collider() {
+    std::vector<Transform> transforms(1);
+    PhysicsEngine engine;
+    engine.transforms = &transforms;
+
+    ColliderHandle front = engine.add_cube_collider(0, vec3(0.5, 0.5, 0.5));
+    ColliderHandle back = engine.add_cube_collider(0, vec3(0.5, 0.5, 0.5));
+    engine.get_collider(front)->body.position() = vec3(5.0, 1.0, 0.0);
+    engine.get_collider(back)->body.position() = vec3(10.0, 1.0, 0.0);
+    engine.refit_broadphase();
+
+    ray r;
+    r.origin = vec3(0.0, 1.0, 0.0);
+    r.direction = vec3(1.0, 0.0, 0.0);
+
+    float t;
+    ColliderHandle hit = engine.raycast(r, &t);
+    check(hit.id == front.id && ABS(t - 4.5) < 1.0e-4, "ray hits the front box");
+
+    engine.remove_collider(front);
+    hit = engine.raycast(r, &t);
+    check(hit.id == back.id && ABS(t - 9.5) < 1.0e-4, "ray passes the removed box and hits the back one");
+}
+
+int main(int argc, char **argv) {
+    test_broadphase(NULL, "aabb tree");
+    test_broadphase(new SweepAndPrune(), "sweep and prune");
+    test_removed_collider();
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_raycasts passed\n");
+    return 0;
+}
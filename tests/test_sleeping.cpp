@@ -0,0 +1,117 @@
+#include <stdio.h>
+
+#include "physics_engine.h"
+
+/*
+ * Checks when sleeping islands wake: an awake body whose box overlaps a sleeper without
+ * touching it leaves it asleep, and a body landing on a sleeping stack wakes the whole
+ * stack in the step it lands, with the stack's own contacts found in that same step. Both
+ * broadphases are run.
+ */
+
+static int num_failures = 0;
+
+static void check(bool condition, const char *name) {
+    if (!condition) {
+        printf("FAIL %s\n", name);
+        num_failures++;
+    }
+}
+
+static Collider *add_box(PhysicsEngine *engine, const vec3 &position, const quat &orientation) {
+    Collider *collider = engine->get_collider(engine->add_cube_collider(0, vec3(0.5, 0.5, 0.5)));
+    collider->body.position() = position;
+    collider->body.orientation() = orientation;
+    collider->body.set_inertia_tensor(RigidBody::create_box_inertia_tensor(1.0, vec3(0.5, 0.5, 0.5)));
+    return collider;
+}
+
+static void settle(PhysicsEngine *engine) {
+    engine->update(0.016);
+    for (int i = 0; i < 300 && engine->stats.num_awake_bodies > 0; i++) {
+        engine->update(0.016);
+    }
+}
+
+/*
+ * A box turned a quarter turn about y stands beside another so that their boxes overlap
+ * but a corner of the turned one passes the other's side with room to spare.
+ */
+static void test_overlapping_boxes_stay_asleep(Broadphase *broadphase) {
+    std::vector<Transform> transforms(1);
+    PhysicsEngine engine;
+    if (broadphase != NULL) {
+        engine.set_broadphase(broadphase);
+    }
+    engine.transforms = &transforms;
+
+    engine.get_collider(engine.add_plane_collider(0))->body.set_static(true);
+    Collider *sleeper = add_box(&engine, vec3(0.0, 0.5, 0.0), quat());
+    Collider *turned = add_box(&engine, vec3(1.15, 0.5, 0.9), quat(vec3(0.0, 1.0, 0.0), 0.25 * M_PI));
+
+    settle(&engine);
+    check(sleeper->body.is_sleeping() && turned->body.is_sleeping(), "both boxes fall asleep");
+    check(sleeper->get_aabb().overlaps(turned->get_aabb()), "the two boxes' bounds overlap");
+
+    turned->body.wake();
+    engine.update(0.016);
+    check(turned->body.is_awake(), "the woken box is awake");
+    check(sleeper->body.is_sleeping(), "the box it does not touch stays asleep");
+    check(engine.stats.num_contact_manifolds == 1, "only the woken box's ground contact is solved");
+}
+
+/*
+ * Two boxes stacked on the ground fall asleep, then a third is dropped onto the top one.
+ */
+static void test_landing_wakes_stack(Broadphase *broadphase) {
+    std::vector<Transform> transforms(1);
+    PhysicsEngine engine;
+    if (broadphase != NULL) {
+        engine.set_broadphase(broadphase);
+    }
+    engine.transforms = &transforms;
+
+    engine.get_collider(engine.add_plane_collider(0))->body.set_static(true);
+    Collider *bottom = add_box(&engine, vec3(0.0, 0.5, 0.0), quat());
+    Collider *top = add_box(&engine, vec3(0.0, 1.5, 0.0), quat());
+    settle(&engine);
+    check(bottom->body.is_sleeping() && top->body.is_sleeping(), "the stack falls asleep");
+
+    float bottom_y = bottom->body.position().y;
+    float top_y = top->body.position().y;
+
+    Collider *dropped = add_box(&engine, vec3(0.0, 3.0, 0.0), quat());
+    int landing_step = -1;
+    for (int i = 0; i < 100 && landing_step == -1; i++) {
+        engine.update(0.016);
+        if (top->body.is_awake()) {
+            landing_step = i;
+        }
+    }
+
+    check(landing_step != -1, "the landing wakes the stack");
+    check(bottom->body.is_awake(), "the landing wakes the bottom of the stack too");
+    check(engine.stats.num_contact_manifolds == 3, "the stack's own contacts are solved in the landing step");
+    check(dropped->body.position().y > top->body.position().y, "the dropped box stays on top");
+
+    for (int i = 0; i < 30; i++) {
+        engine.update(0.016);
+    }
+
+    check(ABS(bottom->body.position().y - bottom_y) < 0.02, "the bottom box holds its height");
+    check(ABS(top->body.position().y - top_y) < 0.02, "the top box holds its height");
+}
+
+int main(int argc, char **argv) {
+    test_overlapping_boxes_stay_asleep(NULL);
+    test_overlapping_boxes_stay_asleep(new SweepAndPrune());
+    test_landing_wakes_stack(NULL);
+    test_landing_wakes_stack(new SweepAndPrune());
+
+    if (num_failures > 0) {
+        return 1;
+    }
+
+    printf("test_sleeping passed\n");
+    return 0;
+}